@@ -0,0 +1,240 @@
+// bench.c: the bench builtin, timing repeated runs of a command
+
+#include "commando.h"
+
+// Runs made by bench are not jobs: they are started with cmd_start()
+// like any other, but their output is hashed as it is read and then
+// thrown away, and they are reaped with wait4() which also gives the
+// CPU time and peak memory of the child. Nothing is added to the job
+// table so a bench of 1000 runs leaves list as it was.
+
+// benchslot_t: a run in progress
+typedef struct {
+  cmd_t *cmd;
+  int run;                 // index of the run, warmup runs first
+  unsigned long long hash; // FNV-1a of the output read so far
+  long long nbytes;        // bytes of output read so far
+} benchslot_t;
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME  1099511628211ULL
+
+static long long tv_nanos(struct timeval *tv)
+{
+  return tv->tv_sec * 1000000000LL + tv->tv_usec * 1000LL;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+  double x = *(double *) a, y = *(double *) b;
+  return (x > y) - (x < y);
+}
+
+static double percentile(double sorted[], int n, double pct)
+// Value at pct percent of the way through sorted[], interpolating
+// between the two nearest values.
+{
+  double pos = pct/100.0 * (n-1);
+  int lo = (int) pos;
+  if(lo+1 >= n){
+    return sorted[n-1];
+  }
+  return sorted[lo] + (pos - lo) * (sorted[lo+1] - sorted[lo]);
+}
+
+static void print_row(char *label, double vals[], int n)
+// Prints the mean, standard deviation, min, percentiles and max of
+// vals[] on one line, sorting vals[] in place.
+{
+  double sum = 0;
+  for(int i = 0; i < n; i++){
+    sum += vals[i];
+  }
+  double mean = sum / n;
+  double squares = 0;
+  for(int i = 0; i < n; i++){
+    squares += (vals[i] - mean) * (vals[i] - mean);
+  }
+  double stddev = (n > 1) ? sqrt(squares / (n-1)) : 0; // sample standard deviation
+  qsort(vals, n, sizeof(double), compare_doubles);
+  printf("%-10s %10.3f %10.3f %10.3f %10.3f %10.3f %10.3f %10.3f\n", label, mean, stddev,
+         vals[0], percentile(vals, n, 50), percentile(vals, n, 90), percentile(vals, n, 99), vals[n-1]);
+}
+
+static void format_status(int wstatus, char *buf, int size)
+// Describes a status from wait4() as EXIT(n) or SIGNALED(n) as list does.
+{
+  if(WIFSIGNALED(wstatus)){
+    snprintf(buf, size, "SIGNALED(%d)", WTERMSIG(wstatus));
+  }
+  else{
+    snprintf(buf, size, "EXIT(%d)", WEXITSTATUS(wstatus));
+  }
+}
+
+void bench_report(benchrun_t runs[], int nruns)
+/* Prints the summary of a bench: a row each for wall, user and system
+  time in milliseconds and peak memory in KB, then whether every run
+  gave the same output and exit status. The format is
+
+  STAT             MEAN     STDDEV        MIN        P50        P90        P99        MAX
+  wall ms         1.523      0.102      1.402      1.498      1.671      1.702      1.706
+  ...
+  output: same in all 10 runs, 6 bytes, hash 5a0b3c7e9d4f1a22
+  status: EXIT(0) in all 10 runs
+*/
+{
+  printf("%-10s %10s %10s %10s %10s %10s %10s %10s\n",
+         "STAT", "MEAN", "STDDEV", "MIN", "P50", "P90", "P99", "MAX");
+  double *vals = malloc(nruns * sizeof(double));
+  char *labels[] = {"wall ms", "user ms", "sys ms", "maxrss KB"};
+  for(int stat = 0; stat < 4; stat++){
+    for(int i = 0; i < nruns; i++){
+      vals[i] = (stat == 0) ? runs[i].wall / 1e6 :
+                (stat == 1) ? runs[i].user / 1e6 :
+                (stat == 2) ? runs[i].sys / 1e6 : runs[i].maxrss;
+    }
+    print_row(labels[stat], vals, nruns);
+  }
+  free(vals);
+
+  int same_output = 0, same_status = 0;
+  for(int i = 0; i < nruns; i++){
+    same_output += (runs[i].hash == runs[0].hash && runs[i].nbytes == runs[0].nbytes);
+    same_status += (runs[i].wstatus == runs[0].wstatus);
+  }
+  if(same_output == nruns){
+    printf("output: same in all %d runs, %lld bytes, hash %016llx\n",
+           nruns, runs[0].nbytes, runs[0].hash);
+  }
+  else{
+    printf("output: NOT deterministic, %d of %d runs match the first\n", same_output, nruns);
+  }
+  char status[STATUS_LEN+1];
+  format_status(runs[0].wstatus, status, sizeof(status));
+  if(same_status == nruns){
+    printf("status: %s in all %d runs\n", status, nruns);
+  }
+  else{
+    printf("status: differs, %d of %d runs match the first, %s\n", same_status, nruns, status);
+  }
+}
+
+static void read_run_output(benchslot_t *slot)
+// Hashes and discards whatever output of the run can be read now.
+{
+  char buf[SEGMENT_SIZE];
+  int nread;
+  while((nread = read(slot->cmd->out_pipe[PREAD], buf, sizeof(buf))) > 0 ||
+        (nread == -1 && errno == EINTR)){
+    for(int i = 0; i < nread; i++){
+      slot->hash = (slot->hash ^ (unsigned char) buf[i]) * FNV_PRIME;
+    }
+    slot->nbytes += (nread > 0) ? nread : 0;
+  }
+  if(nread == 0 || errno != EAGAIN){
+    slot->cmd->output_eof = 1;
+  }
+}
+
+static int reap_run(benchslot_t *slot, benchrun_t *run)
+/* Waits for the child of a run whose output has closed and fills in
+  run, which may be NULL for a warmup run. Returns the errno of a
+  failed exec, 0 if the command ran.
+*/
+{
+  cmd_t *cmd = slot->cmd;
+  struct rusage usage;
+  int wstatus;
+  while(wait4(cmd->pid, &wstatus, 0, &usage) == -1 && errno == EINTR){
+    // interrupted by SIGCHLD of another run, wait again
+  }
+  long long reaped = now_nanos();
+  cmd_read_exec_pipe(cmd);
+  int err = cmd->exec_errno;
+  if(run != NULL){
+    run->wall = reaped - cmd->times.fork;
+    run->user = tv_nanos(&usage.ru_utime);
+    run->sys = tv_nanos(&usage.ru_stime);
+    run->maxrss = usage.ru_maxrss;
+    run->hash = slot->hash;
+    run->nbytes = slot->nbytes;
+    run->wstatus = wstatus;
+  }
+  close(cmd->out_pipe[PREAD]);
+  cmd_free(cmd);
+  return err;
+}
+
+int cmdcol_bench(cmdcol_t *col, int nruns, int nwarmup, char *argv[])
+/* Runs argv nwarmup times untimed and then nruns times timed, and
+  prints a summary with bench_report(). Runs go one at a time unless
+  max-jobs is set, in which case that many run at once; more at once
+  finishes sooner but the runs compete for the machine. Output is
+  hashed to check the command is deterministic and then discarded.
+  The prompt waits until all runs are done. Returns 0 on success and
+  -1 if the command could not be run, after saying why.
+*/
+{
+  int nslots = (col->max_running > 0) ? col->max_running : 1;
+  int total = nwarmup + nruns;
+  printf("bench: %d runs of %s after %d warmup, %d at a time\n", nruns, argv[0], nwarmup, nslots);
+  fflush(stdout);
+
+  benchrun_t *runs = calloc(nruns, sizeof(benchrun_t));
+  benchslot_t *slots = calloc(nslots, sizeof(benchslot_t));
+  struct pollfd *pfds = calloc(nslots, sizeof(struct pollfd));
+  int nactive = 0, started = 0, done = 0;
+  int failed = 0;        // errno of a failed exec or start
+  while(done < started || (started < total && !failed)){
+    while(nactive < nslots && started < total && !failed){
+      cmd_t *cmd = cmd_new(argv);
+      if(cmd_start(cmd) == -1){
+        failed = (errno != 0) ? errno : EAGAIN;
+        cmd_free(cmd);
+        break;
+      }
+      slots[nactive++] = (benchslot_t) { .cmd = cmd, .run = started++, .hash = FNV_OFFSET };
+    }
+    if(nactive == 0){
+      break;
+    }
+
+    for(int i = 0; i < nactive; i++){
+      pfds[i] = (struct pollfd) { .fd = slots[i].cmd->out_pipe[PREAD], .events = POLLIN };
+    }
+    if(poll(pfds, nactive, -1) == -1 && errno != EINTR){
+      perror("bench");
+      break;
+    }
+    for(int i = nactive-1; i >= 0; i--){ // backwards so removing slot i leaves the rest
+      if(pfds[i].revents == 0){
+        continue;
+      }
+      read_run_output(&slots[i]);
+      if(!slots[i].cmd->output_eof){
+        continue;
+      }
+      int run = slots[i].run - nwarmup;
+      int err = reap_run(&slots[i], (run >= 0) ? &runs[run] : NULL);
+      if(err != 0 && !failed){
+        failed = err;
+      }
+      slots[i] = slots[--nactive];
+      done++;
+    }
+  }
+
+  int ret = 0;
+  if(failed){
+    printf("bench: could not run %s: %s\n", argv[0], strerror(failed));
+    ret = -1;
+  }
+  else{
+    bench_report(runs, nruns);
+  }
+  free(pfds);
+  free(slots);
+  free(runs);
+  return ret;
+}
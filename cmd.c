@@ -9,7 +9,8 @@ cmd_t *cmd_new(char *argv[]) // takes in an array of string arguments
   Allocates a new cmd_t with the given argv[] array. Makes string
   copies of each of the strings contained within argv[] using
   strdup() as they likely come from a source that will be
-  altered. Ensures that cmd->argv[] is ended with NULL. Sets the name
+  altered. Ensures that cmd->argv[] is ended with NULL. The argv[]
+  array is allocated to fit so a cmd_t stays small. Sets the name
   field to be the argv[0]. Sets finished to 0 (not finished yet). Set
   str_status to be "INIT" using snprintf(). Initializes the remaining
   fields to obvious default values such as -1s, and NULLs.
@@ -18,8 +19,14 @@ cmd_t *cmd_new(char *argv[]) // takes in an array of string arguments
   // First step is to use malloc() to allocate a hunk of memory (cmd_t)
   cmd_t *new = malloc(sizeof(cmd_t)); // new is a pointer to cmd_t struct
 
+  int argc = 0;
+  while(argv[argc] != NULL && argc < ARG_MAX){
+    argc++;
+  }
+  new->argv = malloc((argc+1) * sizeof(char *)); // only as long as needed, not ARG_MAX
+
   int i = 0; // i marks current position
-  while(argv[i] != NULL){
+  while(i < argc){
     new->argv[i] = strdup(argv[i]); // Makes string copies of each and stores them into argv[], which is an array of string arguments
     //printf("new->argv[%d] is: %s\n", i, new->argv[i]); // debugger
     i++; // Increment i
@@ -27,8 +34,8 @@ cmd_t *cmd_new(char *argv[]) // takes in an array of string arguments
   new->argv[i] = NULL; // Ensures that cmd->argv[] is null-terminated
   //printf("new->argv[%d] is: %s\n", i, new->argv[i]);
 
-  // Sets the name field to be the argument at argv[0]. What this does is it essentially copies the entire string at argv[0] and stores it in char name[NAME_MAX+1].
-  strcpy(new->name, new->argv[0]);
+  // Sets the name field to be the argument at argv[0]. It shares the string rather than copying it.
+  new->name = new->argv[0];
 
   new->finished = 0; // Sets finished to 0 (not finished yet)
 
@@ -69,10 +76,170 @@ cmd_t *cmd_new(char *argv[]) // takes in an array of string arguments
   new->status = -1;
   new->output = NULL;
   new->output_size = -1;
+  new->input_file = NULL;
+  new->input = NULL;
+  new->input_size = 0;
+  new->after = NULL;
+  new->nafter = 0;
+  new->after_ok = 0;
+  new->job = -1;
+  new->segs = NULL;
+  new->segs_tail = NULL;
+  new->drained_size = 0;
+  new->cut_size = 0;
+  new->chunks = NULL;
+  new->nchunks = 0;
+  new->chunks_max = 0;
+  new->output_eof = 0;
+  new->exec_pipe = -1;
+  new->exec_errno = 0;
+  new->spill_file = NULL;
+  new->stopped = 0;
+  new->last_used = 0;
+  new->capture = CAPTURE_PIPE;
+  new->capture_fd = -1;
+  new->output_mapped = 0;
+  new->matcher = NULL;
+  memset(&new->times, 0, sizeof(new->times));
+  new->times.created = now_nanos();
+  PROBE(cmd_new, new->name, argc);
 
   return new;
 }
 
+static int embedded = 0; // 1 in libcommando, see cmd_set_embedded()
+
+void cmd_set_embedded(int on)
+/* Set by libcommando, whose host has its own use for standard output:
+  with on nonzero no alerts or error messages are printed, failures
+  being left to the return values the library turns into error codes,
+  and the host's stdout is never flushed. cmd_fetch_output() then
+  never blocks either.
+*/
+{
+  embedded = on;
+}
+
+static void free_output(cmd_t *cmd)
+// Releases cmd->output however it was allocated and any segments
+// holding output, leaving both NULL.
+{
+  if(cmd->output_mapped){
+    munmap(cmd->output, cmd->output_size + 1);
+  }
+  else{
+    free(cmd->output);
+  }
+  cmd->output = NULL;
+  cmd->output_mapped = 0;
+  segment_release(cmd->segs);
+  cmd->segs = NULL;
+  cmd->segs_tail = NULL;
+}
+
+static void close_output_fds(cmd_t *cmd)
+// Closes whatever cmd_start() opened for output when it cannot go on.
+{
+  if(cmd->capture_fd != -1){
+    close(cmd->capture_fd);
+    cmd->capture_fd = -1;
+    cmd->output_eof = 0;
+  }
+  else{
+    close(cmd->out_pipe[PREAD]);
+    close(cmd->out_pipe[PWRITE]);
+    cmd->out_pipe[PREAD] = cmd->out_pipe[PWRITE] = -1;
+  }
+}
+
+static int open_capture_file(cmd_t *cmd)
+// Opens an anonymous file for the output of cmd, a memfd if possible
+// or else an unlinked file in $TMPDIR. Returns -1 on failure.
+{
+  int fd = memfd_create(cmd->name, MFD_CLOEXEC);
+  if(fd == -1 && errno != EMFILE && errno != ENFILE){
+    char *dir = getenv("TMPDIR");
+    fd = open((dir != NULL) ? dir : "/tmp", O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+  }
+  return fd;
+}
+
+static int open_pty(int fds[2])
+/* Opens a pseudo-terminal for CAPTURE_PTY putting the master in
+  fds[PREAD] and the slave in fds[PWRITE], both close-on-exec like the
+  ends of a pipe. The terminal is put in raw mode so output passes
+  through without newlines becoming CRLF. Returns -1 on failure.
+*/
+{
+  int master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+  if(master == -1){
+    return -1;
+  }
+  char name[64];
+  int slave = -1;
+  if(grantpt(master) == 0 && unlockpt(master) == 0 && ptsname_r(master, name, sizeof(name)) == 0){
+    slave = open(name, O_RDWR | O_NOCTTY | O_CLOEXEC);
+  }
+  if(slave == -1){
+    int saved_errno = errno;
+    close(master);
+    errno = saved_errno;
+    return -1;
+  }
+  struct termios tio;
+  tcgetattr(slave, &tio);
+  cfmakeraw(&tio);
+  tcsetattr(slave, TCSANOW, &tio);
+  fds[PREAD] = master;
+  fds[PWRITE] = slave;
+  return 0;
+}
+
+static void map_capture_file(cmd_t *cmd)
+/*
+  Maps the capture file of a finished cmd as its output and closes
+  the file. The file is grown by one byte first so the output ends in
+  a null character like those read from a pipe. Outputs too big for
+  output_size are cut short with a message. If the file cannot be
+  mapped the output is left NULL, as for one which is not ready.
+*/
+{
+  cmd_drain(cmd, 0); // picks up the exec time, there is no pipe to read
+  struct stat st;
+  fstat(cmd->capture_fd, &st);
+  long long size = st.st_size;
+  if(size > MAX_OUTPUT){
+    if(!embedded){
+      printf("%s[#%d]: output of %lld bytes cut to %d\n", cmd->name, cmd->pid, size, MAX_OUTPUT);
+    }
+    size = MAX_OUTPUT;
+  }
+  void *map = MAP_FAILED;
+  if(ftruncate(cmd->capture_fd, size + 1) == 0){
+    map = mmap(NULL, size + 1, PROT_READ, MAP_SHARED, cmd->capture_fd, 0);
+  }
+  if(map == MAP_FAILED){
+    if(!embedded){
+      perror("Could not map output");
+    }
+    close(cmd->capture_fd);
+    cmd->capture_fd = -1;
+    return;
+  }
+  cmd->output = map;
+  cmd->output_mapped = 1;
+  cmd->output_size = size;
+  cmd->last_used = now_nanos(); // freshly captured output is the last to be evicted
+  cmd->times.output_eof = cmd->times.reaped;
+  cmd->times.captured = now_nanos();
+  close(cmd->capture_fd); // the mapping keeps the file alive
+  cmd->capture_fd = -1;
+  if(cmd->exec_pipe != -1){
+    close(cmd->exec_pipe);
+    cmd->exec_pipe = -1;
+  }
+}
+
 void cmd_free(cmd_t *cmd)
 /*
   Deallocates a cmd structure. Deallocates the strings in the argv[]
@@ -86,20 +253,163 @@ void cmd_free(cmd_t *cmd)
     i++;
   }
   free(cmd->argv[i]); // Finally free the last string NULL
+  free(cmd->argv);
 
-  if(cmd->output != NULL){
-    free(cmd->output);
+  free_output(cmd);
+  if(cmd->capture_fd != -1){
+    close(cmd->capture_fd);
+  }
+  else if(cmd->pid > 0 && !cmd->output_eof){
+    close(cmd->out_pipe[PREAD]); // still running, or held open by what it left behind
+  }
+  if(cmd->input_file != NULL){
+    free(cmd->input_file);
+  }
+  free(cmd->after);
+  free(cmd->chunks);
+  matcher_free(cmd->matcher);
+  if(cmd->exec_pipe != -1){
+    close(cmd->exec_pipe);
+  }
+  if(cmd->spill_file != NULL){
+    unlink(cmd->spill_file); // evicted copy is only needed while the job exists
+    free(cmd->spill_file);
   }
   free(cmd); // Finally deallocates cmd itself.
 }
 
-/* Profesor said to ignore
-void cmd_set_stdin(cmd_t *cmd, char *input_file){
+void cmd_set_stdin(cmd_t *cmd, char *input_file)
+/*
+  Sets the file that the child's standard input will be read from
+  when cmd_start() is called. Makes a copy of input_file with
+  strdup(). Passing NULL restores the default of /dev/null so that
+  children never read commando's own input.
+*/
+{
+  if(cmd->input_file != NULL){
+    free(cmd->input_file);
+  }
+  cmd->input_file = (input_file != NULL) ? strdup(input_file) : NULL;
+}
 
+void cmd_set_input(cmd_t *cmd, void *input, int input_size)
+/*
+  Sets a buffer, usually the output of another job, which will be fed
+  to the child's standard input when cmd_start() is called. The
+  buffer is not copied and must stay valid until cmd_start() is
+  called. Takes precedence over any file set with cmd_set_stdin().
+*/
+{
+  cmd->input = input;
+  cmd->input_size = input_size;
+}
+
+void cmd_set_after(cmd_t *cmd, int after[], int nafter, int after_ok)
+/*
+  Records the job numbers which must finish before cmd may be started
+  by the scheduler in cmdcol_schedule(). If after_ok is 1 they must
+  also finish with EXIT(0). Copies after[] and changes str_status to
+  WAIT to show the cmd is waiting on other jobs.
+*/
+{
+  free(cmd->after);
+  cmd->after = malloc(nafter * sizeof(int));
+  memcpy(cmd->after, after, nafter * sizeof(int));
+  cmd->nafter = nafter;
+  cmd->after_ok = after_ok;
+  snprintf(cmd->str_status, STATUS_LEN+1, "WAIT");
 }
+
+static void feed_input(void *input, int input_size, int fd)
+/*
+  Writes all of input into the pipe fd using vmsplice() so the pages
+  are handed to the pipe without being copied. Falls back to write()
+  if vmsplice() is not supported. Used by a detached feeder process
+  which exits when done.
 */
+{
+  char *pos = input;
+  int left = input_size;
+  while(left > 0){
+    struct iovec iov = { .iov_base = pos, .iov_len = left };
+    ssize_t nwrite = vmsplice(fd, &iov, 1, 0);
+    if(nwrite == -1 && errno == EINTR){
+      continue;
+    }
+    if(nwrite == -1){
+      nwrite = write(fd, pos, left); // vmsplice() unavailable, copy instead
+    }
+    if(nwrite <= 0){
+      return; // reader went away, nothing more to do
+    }
+    pos += nwrite;
+    left -= nwrite;
+  }
+}
 
-void cmd_start(cmd_t *cmd)
+static void setup_failed(int exec_fd)
+// Ends a child which could not be set up to exec, sending errno over
+// exec_fd after a time as a failed exec does so the parent reports it
+// as FAILED(errno). _exit() leaves the atexit() cleanup to the parent.
+{
+  int err = errno;
+  long long exec_time = now_nanos(); // read first, exec was not reached
+  write(exec_fd, &exec_time, sizeof(exec_time));
+  write(exec_fd, &err, sizeof(err));
+  _exit(127);
+}
+
+static void setup_stdin(cmd_t *cmd, int exec_fd)
+/*
+  Called in the child by cmd_start() to redirect standard input. If
+  cmd->input is set, a pipe is created and a detached feeder process
+  streams the input into it; the double fork leaves the feeder
+  orphaned so it never becomes a zombie of the command. The feeder
+  never execs so it closes every fd it inherited but the write end of
+  the pipe: holding the output pipe or exec_fd, the write end of
+  exec_pipe, would keep commando from seeing end of file on them
+  until all the input was written. Otherwise opens cmd->input_file or
+  /dev/null if none was given. If the input cannot be set up the
+  child ends through setup_failed() with the errno of the failure.
+*/
+{
+  int in_fd;
+  if(cmd->input != NULL){
+    int in_pipe[2];
+    if(pipe2(in_pipe, O_CLOEXEC) == -1){
+      setup_failed(exec_fd);
+    }
+    pid_t middle = fork();
+    if(middle == 0){
+      close(in_pipe[PREAD]);
+      close(STDOUT_FILENO);          // feeder must not hold the output pipe open
+      close(cmd->out_pipe[PWRITE]);
+      close(exec_fd);                // nor exec_pipe, which is closed by the exec it never makes
+      if(in_pipe[PWRITE] > 0){       // nor anything else, where close_range() is supported
+        close_range(0, in_pipe[PWRITE] - 1, 0);
+      }
+      close_range(in_pipe[PWRITE] + 1, ~0U, 0);
+      if(fork() == 0){      // feeder, orphaned once middle exits
+        feed_input(cmd->input, cmd->input_size, in_pipe[PWRITE]);
+      }
+      _exit(0);
+    }
+    close(in_pipe[PWRITE]);
+    waitpid(middle, NULL, 0); // reap middle right away
+    in_fd = in_pipe[PREAD];
+  }
+  else{
+    char *path = (cmd->input_file != NULL) ? cmd->input_file : "/dev/null";
+    in_fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(in_fd == -1){
+      setup_failed(exec_fd);
+    }
+  }
+  dup2(in_fd, STDIN_FILENO);
+  close(in_fd);
+}
+
+int cmd_start(cmd_t *cmd)
 /*
   Forks a process and starts executes command in cmd in the process.
   Changes the str_status field to "RUN" using snprintf(). Creates a
@@ -108,76 +418,217 @@ void cmd_start(cmd_t *cmd)
   child process, directs standard output to the pipe using the dup2()
   command. For both parent and child, ensures that unused file
   descriptors for the pipe are closed (write in the parent, read in
-  the child).
+  the child). Standard input of the child comes from the input or
+  input_file set for the cmd, or /dev/null if neither was set.
+
+  With a capture of CAPTURE_MEMFD, standard output goes to a memfd
+  (an unlinked temporary file if memfds are not available) instead
+  of out_pipe so nothing is read while the child runs; out_pipe stays
+  -1 and output_eof is set from the start. cmd_fetch_output() maps
+  the file once the child exits.
+
+  With a capture of CAPTURE_PTY, out_pipe holds the master and slave
+  of a pseudo-terminal rather than a pipe. Standard output of the child
+  is then a terminal so stdio in the child flushes each line instead
+  of filling a 4K buffer first, and output is drained as it is
+  printed. If no pty can be had for a reason other than running out
+  of file descriptors, the cmd falls back to CAPTURE_PIPE.
+
+  The program is found with path_lookup() in the parent so the child
+  can execv() it directly; execvp() is only the fallback.
+
+  The child writes the time it calls execvp() into exec_pipe; the
+  parent picks this up in cmd_drain(). If the exec fails the child
+  writes its errno after that and _exit()s right away, which
+  cmd_update_state() reports as FAILED(errno); so does a child whose
+  input from '< file' cannot be opened. The read end of out_pipe is
+  made non-blocking so output can be drained while the child runs.
+
+  All pipes are close-on-exec so a child holds only its own stdin and
+  stdout and never keeps the pipes of other jobs open. If commando is
+  out of file descriptors or processes, returns -1 leaving cmd
+  unstarted so it can be tried again later; returns 0 on success.
 */
 {
     // Create a pipe associated with the cmd->out_pipe field
     // This way the parent and child has access to work with pipe
-    pipe(cmd->out_pipe);
+    int exec_pipe[2];
+    if(cmd->capture == CAPTURE_PTY && open_pty(cmd->out_pipe) == -1){
+      if(errno == EMFILE || errno == ENFILE){
+        return -1; // try again once jobs finish
+      }
+      cmd->capture = CAPTURE_PIPE; // no ptys here, a pipe will have to do
+    }
+    if(cmd->capture == CAPTURE_MEMFD){
+      cmd->capture_fd = open_capture_file(cmd);
+      if(cmd->capture_fd == -1){
+        return -1;
+      }
+      cmd->output_eof = 1; // nothing to drain
+    }
+    else if(cmd->capture == CAPTURE_PIPE && pipe2(cmd->out_pipe, O_CLOEXEC) == -1){
+      return -1; // EMFILE or ENFILE, try again once jobs finish
+    }
+    if(pipe2(exec_pipe, O_CLOEXEC) == -1){
+      close_output_fds(cmd);
+      return -1;
+    }
 
-    // Ensure that cmd->str_status is changes to RUN, use snprintf()
-    snprintf(cmd->str_status, STATUS_LEN+1, "RUN");
+    // Look up the program in the parent where the answer is cached,
+    // rather than having execvp() search PATH in every child
+    char *exec_path = path_lookup(cmd->name);
 
     // Fork a new process and capture its pid in the cmd->pid field
     // Can I do this? cmd->pid = fork();
+    if(!embedded){
+      fflush(stdout); // the child must not inherit and later repeat buffered output
+    }
+    cmd->times.fork = now_nanos();
+    PROBE(cmd_fork, cmd->job, cmd->name, cmd->capture);
     pid_t child = fork();
-    if(child < 0){  // check if fork failed
-      perror("Failed to fork"); // report errors if forking failed
-      exit(1);
+    if(child < 0){  // check if fork failed, usually EAGAIN from too many processes
+      close_output_fds(cmd);
+      close(exec_pipe[PREAD]);
+      close(exec_pipe[PWRITE]);
+      cmd->times.fork = 0;
+      return -1;
     }
 
+    // Ensure that cmd->str_status is changes to RUN, use snprintf()
+    snprintf(cmd->str_status, STATUS_LEN+1, "RUN");
+
     // Child process
     if(child == 0) // It's a child
     {
       //printf("I am the child\n"); // debugger
       // The child process will need to use dup2() to alter its standard output to write instead to the write to cmd->out_pipe[PRW]
-      dup2(cmd->out_pipe[PWRITE], STDOUT_FILENO);
-      close(cmd->out_pipe[PREAD]); // child closes the read end of pipe
+      if(cmd->capture_fd != -1){
+        dup2(cmd->capture_fd, STDOUT_FILENO);
+      }
+      else{
+        dup2(cmd->out_pipe[PWRITE], STDOUT_FILENO);
+        close(cmd->out_pipe[PREAD]); // child closes the read end of pipe
+      }
+      setup_stdin(cmd, exec_pipe[PWRITE]); // never let the child read commando's input
+      setpgid(0, 0);               // own process group so shutdown can signal whatever the job started
+      close(exec_pipe[PREAD]);
+      long long exec_time = now_nanos();
+      write(exec_pipe[PWRITE], &exec_time, sizeof(exec_time)); // pipe closes itself if exec succeeds
 
       // execvp format
       // char *new_argv[] = {"ls", "-l", NULL};
       // char command = "ls";
       // The child should call execvp() with the name of the command and argv[] array stored in the passed cmd. This should launch a new program with output that is directed into the pipe set up above
 
-      execvp(cmd->name, cmd->argv); // Am I doing this right? Prof says yes.
+      if(exec_path != NULL){
+        execv(exec_path, cmd->argv); // resolved from the cache, no PATH search
+      }
+      execvp(cmd->name, cmd->argv); // not found or stale, search PATH for the error
+
+      // Only get here if the exec failed. Tell the parent why and leave
+      // at once: returning would make this child a second commando
+      // reading the same input, and exit() would run the parent's
+      // atexit() cleanup.
+      int err = errno;
+      write(exec_pipe[PWRITE], &err, sizeof(err));
+      _exit(127);
     }
     else{ // Parent process
 
       //printf("I am the parent of child #%d\n", child); // debugger
+      cmd->times.forked = now_nanos();
       cmd->pid = child;
+      setpgid(child, child); // as in the child, whichever runs first
+      PROBE(cmd_forked, cmd->job, cmd->pid, cmd->times.forked - cmd->times.fork);
       //printf("I stored child's number in pid as #%d\n", cmd->pid);
-      close(cmd->out_pipe[PWRITE]); // Parent closes the write end of pipe
+      if(cmd->capture_fd == -1){
+        close(cmd->out_pipe[PWRITE]); // Parent closes the write end of pipe
+        fcntl(cmd->out_pipe[PREAD], F_SETFL, O_NONBLOCK);
+      }
+      close(exec_pipe[PWRITE]);
+      cmd->exec_pipe = exec_pipe[PREAD];
+      fcntl(cmd->exec_pipe, F_SETFL, O_NONBLOCK);
     }
+    return 0;
 
 }
 
+void cmd_read_exec_pipe(cmd_t *cmd)
+// Picks up what the child sent over exec_pipe: the time it called exec
+// and then its errno if the exec failed. Closes the pipe at end of file.
+{
+  while(cmd->exec_pipe != -1){
+    int nread;
+    if(cmd->times.exec == 0){
+      nread = read(cmd->exec_pipe, &cmd->times.exec, sizeof(cmd->times.exec));
+    }
+    else{
+      nread = read(cmd->exec_pipe, &cmd->exec_errno, sizeof(cmd->exec_errno));
+    }
+    if(nread == -1 && errno == EAGAIN){
+      return; // exec still pending or it succeeded and the pipe is not closed yet
+    }
+    if(nread <= 0 && !(nread == -1 && errno == EINTR)){
+      close(cmd->exec_pipe);
+      cmd->exec_pipe = -1;
+    }
+  }
+}
+
 void cmd_update_state(cmd_t *cmd, int block)
 /*
-  If the finished flag is 1, does nothing. Otherwise, updates the
-  state of cmd.  Uses waitpid() and the pid field of command to wait
+  If the finished flag is 1 or the cmd has not been started, does
+  nothing. Otherwise, updates the state of cmd.  Uses waitpid() and
+  the pid field of command to wait
   selectively for the given process. Passes block (one of DOBLOCK or
   NOBLOCK) to waitpid() to cause either non-blocking or blocking
-  waits.  Uses the macro WIFEXITED to check the returned status for
-  whether the command has exited. If so, sets the finished field to 1
-  and sets the cmd->status field to the exit status of the cmd using
-  the WEXITSTATUS macro. Calls cmd_fetch_output() to fill up the
-  output buffer for later printing.
+  waits. The returned status is dissected with the W* macros:
+
+  WIFEXITED    str_status EXIT(n), status n, finished
+               or FAILED(errno), status 127, if the exec failed
+  WIFSIGNALED  str_status SIGNALED(n), status 128+n, finished
+  WIFSTOPPED   str_status STOPPED, stopped set
+  WIFCONTINUED str_status CONT, stopped cleared
 
-  When a command finishes (the first time), prints a status update
-  message of the form
+  Calls cmd_fetch_output() for a finished cmd to fill up the output
+  buffer for later printing, including whatever a killed cmd printed
+  before it died. A blocking wait also returns when the child stops
+  as a stopped child never closes its output.
+
+  Each change of state prints a status update message of the form
 
   @!!! ls[#17331]: EXIT(0)
 
-  which includes the command name, PID, and exit status.
+  which includes the command name, PID, and new status.
 */
 {
-  if(cmd->finished == 1){
-    // do nothing
+  if(cmd->finished == 1 || cmd->pid == -1){
+    // do nothing, finished or not started yet
     return; // return
   }
   // update the state of cmd
+  // Keep the pipe from filling up, which would stop the child before it
+  // can exit. When blocking, this reads until the child closes its output
+  // but checks in between for the child stopping which would leave it
+  // waiting forever.
   int status;
-  int retcode = waitpid(cmd->pid, &status, block); // Get return value
+  int retcode = 0;
+  if(block == DOBLOCK){
+    while(!cmd->output_eof && retcode == 0){
+      struct pollfd pfd = { .fd = cmd->out_pipe[PREAD], .events = POLLIN };
+      poll(&pfd, 1, 100); // wakes at once for output, otherwise checks for a stop every 100ms
+      cmd_drain(cmd, 0);
+      retcode = waitpid(cmd->pid, &status, NOBLOCK);
+    }
+  }
+  else{
+    cmd_drain(cmd, 0);
+  }
+  if(retcode == 0){
+    do{ // a SIGCHLD handler may interrupt a blocking wait
+      retcode = waitpid(cmd->pid, &status, block); // Get return value
+    } while(retcode == -1 && errno == EINTR);
+  }
   // Returned     Means
   // child_pid    status of child that changed or exited
   // 0            there is no status change for child / none exited
@@ -186,79 +637,286 @@ void cmd_update_state(cmd_t *cmd, int block)
   If a state change has occurred, it can be dissected using a series of macros in the manual entry for wait() and waitpid(). The most important of these is the WIFEXITED(status) macro which is called on a status integer passed to waitpid().
   */
 
-  if(retcode == 0){
-      // there is no status change for child. Return.
+  if(retcode == 0 || retcode == -1){
+      // there is no status change for child or an error. Return.
       return;
   }
-  else{ // status changed occurred
-    if(WIFEXITED(status)){  // Determine if child actually exited, nonzero if exited.
-      int retval = WEXITSTATUS(status);// Get return value of program, 0-255; nonzero exit codes usually inidicate failure.
-
-      cmd->status = retval; // sets the cmd->status field to the exit status of the cmd
+  if(WIFEXITED(status)){  // Determine if child actually exited, nonzero if exited.
+    int retval = WEXITSTATUS(status);// Get return value of program, 0-255; nonzero exit codes usually inidicate failure.
+    cmd->status = retval; // sets the cmd->status field to the exit status of the cmd
+    cmd_read_exec_pipe(cmd); // child has exited so its errno is in the pipe if the exec failed
+    if(cmd->exec_errno != 0){
+      snprintf(cmd->str_status, STATUS_LEN + 1, "FAILED(%d)", cmd->exec_errno);
+    }
+    else{
       snprintf(cmd->str_status, STATUS_LEN + 1, "EXIT(%d)", retval); // change cmd->str_status to EXIT(num) when the process finishes
-      cmd->finished = 1; // set to finished
-      cmd_fetch_output(cmd); // Calls cmd_fetch_output() to fill up the output buffer for later printing
-      printf("@!!! %s[#%d]: %s\n", cmd->name, cmd->pid, cmd->str_status); // print message, only once per change/exit
-      return; // done and return
     }
   }
+  else if(WIFSIGNALED(status)){ // killed, finished just like an exit
+    int sig = WTERMSIG(status);
+    cmd->status = 128 + sig; // as shells report it
+    snprintf(cmd->str_status, STATUS_LEN + 1, "SIGNALED(%d)", sig);
+  }
+  else if(WIFSTOPPED(status)){ // still alive, output stays open
+    cmd->stopped = 1;
+    snprintf(cmd->str_status, STATUS_LEN + 1, "STOPPED");
+  }
+  else if(WIFCONTINUED(status)){
+    cmd->stopped = 0;
+    snprintf(cmd->str_status, STATUS_LEN + 1, "CONT");
+  }
+  if(WIFEXITED(status) || WIFSIGNALED(status)){
+    cmd->finished = 1; // set to finished
+    cmd->stopped = 0;
+    cmd->times.reaped = now_nanos();
+    cmd_fetch_output(cmd); // Calls cmd_fetch_output() to fill up the output buffer for later printing
+  }
+  PROBE(cmd_state, cmd->job, cmd->pid, cmd->status, cmd->str_status, cmd->finished);
+  cmd_alert(cmd, cmd->str_status); // print message, only once per change/exit
 }
 
-char *read_all(int fd, int *nread)
+void cmd_alert(cmd_t *cmd, char *what)
 /*
-  Reads all input from the open file descriptor fd. Stores the
-  results in a dynamically allocated buffer which may need to grow as
-  more data is read. Uses an efficient growth scheme such as
-  doubling the size of the buffer when additional space is
-  needed. Uses realloc() for resizing.  When no data is left in fd,
-  sets the integer pointed to by nread to the number of bytes read
-  and return a pointer to the allocated buffer. Ensures the return
-  string is null-terminated. Does not call close() on the fd as this
-  is done elsewhere.
-*/
-{
-  // See lab 3 and append_all.c file
+  Prints an alert about cmd such as a change of state
 
-  // Allocate some initial memory in a buffer to read() into from the file descriptor. For each read() call, limit the number of bytes read so that this buffer is not overflowed.
-  int max_size = 1024; // start with this size prof says
-  int cur_pos = 0; // set beginning position
-  char *buffer = malloc(max_size*sizeof(char)); // dynamically allocate some memory to buffer
+  @!!! ls[#17251]: EXIT(0)
 
-  // format for read(): read(int_fd, buffer, SIZE);
-  // read() reads upt to SIZE from fd, stores bytes in buffer and returns number of bytes read, -1 for error
+  unless embedded, see cmd_set_embedded().
+*/
+{
+  if(!embedded){
+    printf("@!!! %s[#%d]: %s\n", cmd->name, cmd->pid, what);
+  }
+}
 
-  while(1){ // while true
-    if(cur_pos >= max_size){ // if cur_pos is greater than max_size
-      max_size *= 2; // double max_size, 1024 to 2048 and so on
-      buffer = realloc(buffer, max_size); // allocate more memory
+char *read_all(int fd, int *nread)
+/*
+  Reads all input from the open file descriptor fd. The data goes into
+  a chain of fixed-size segments so nothing already read is copied as
+  more arrives, then the chain is joined once into a dynamically
+  allocated buffer which is exactly the size read plus one for the
+  null terminator. When no data is left in fd, sets the integer
+  pointed to by nread to the number of bytes read and returns the
+  buffer. Does not call close() on the fd as this is done elsewhere.
+  If the read fails or memory runs out, returns NULL with errno set
+  and nread set to -1.
+*/
+{
+  outseg_t *segs = segment_get();
+  outseg_t *tail = segs;
+  int cur_pos = 0; // total bytes read so far
+  *nread = -1;
 
-      if(buffer == NULL){ // check for failure
-        perror("Could not expand input buffer; Exiting.\n");
-        exit(1);
+  while(tail != NULL){ // until end of input or an error
+    if(tail->len == SEGMENT_SIZE){ // segment full, chain on another
+      tail->next = segment_get();
+      tail = tail->next;
+      continue;
+    }
+    int bytes_read = read(fd, tail->data + tail->len, SEGMENT_SIZE - tail->len);
+    if(bytes_read == -1 && errno == EINTR){
+      continue; // interrupted by a signal before reading anything, try again
+    }
+    else if(bytes_read == -1){
+      break; // give up, the caller decides what to do about it
+    }
+    else if(bytes_read == 0){ // 0 bytes read indicates end of file/input
+      char *buffer = segment_join(segs, cur_pos); // null-terminated, read() does NOT do that
+      if(buffer != NULL){
+        *nread = cur_pos;
       }
+      segment_release(segs);
+      return buffer;
     }
+    tail->len += bytes_read;
+    cur_pos += bytes_read; // successful read, advance input buffer position
+  }
 
-    int max_read = max_size - cur_pos; // calculate max read
-    int bytes_read = read(fd, buffer + cur_pos, max_read);
+  int err = errno;
+  segment_release(segs);
+  errno = err;
+  return NULL;
+}
 
-    cur_pos += bytes_read; // successful read, advance input buffer position
+int write_all(int fd, struct iovec *iov, int iovcnt)
+/*
+  Writes all of the buffers in iov[] to fd with as few writev() calls
+  as possible, picking up after partial writes which happen on pipes
+  and for very large outputs. The iov[] array is modified. Returns 0
+  on success and -1 on an error with errno set.
+*/
+{
+  while(iovcnt > 0){
+    ssize_t nwrite = writev(fd, iov, iovcnt);
+    if(nwrite == -1){
+      if(errno == EINTR){
+        continue;
+      }
+      return -1;
+    }
+    while(iovcnt > 0 && nwrite >= (ssize_t) iov->iov_len){ // skip finished buffers
+      nwrite -= iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+    if(iovcnt > 0){ // partially written buffer
+      iov->iov_base = (char *) iov->iov_base + nwrite;
+      iov->iov_len -= nwrite;
+    }
+  }
+  return 0;
+}
 
-    if(bytes_read == 0){ // 0 bytes read indicates end of file/input
-      //printf("End of input\n"); // debugger
+long long now_nanos(void)
+/*
+  Returns the current CLOCK_MONOTONIC time in nanoseconds. The clock
+  is shared by all processes so children may record times as well.
+*/
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
 
-      buffer = realloc(buffer, max_size + 1); // give one more space for null terminating character
-      *nread = cur_pos; // cur_pos marks total bytes read out of max_size
-      //printf("total read is %d\n", cur_pos);
-      // read() function does NOT null terminate!!!
+static void record_chunk(cmd_t *cmd, int offset, long long at)
+// Notes that output starting at offset was read at time at. Reads
+// within CHUNK_MERGE_NS of the start of the last chunk join it so a
+// job streaming output adds a chunk every millisecond at most. If
+// memory runs out the read joins the last chunk after all.
+{
+  if(cmd->nchunks > 0 && at - cmd->chunks[cmd->nchunks-1].at < CHUNK_MERGE_NS){
+    return;
+  }
+  if(cmd->nchunks == cmd->chunks_max){
+    int chunks_max = (cmd->chunks_max == 0) ? 16 : 2*cmd->chunks_max;
+    outchunk_t *chunks = realloc(cmd->chunks, chunks_max * sizeof(outchunk_t));
+    if(chunks == NULL){
+      return; // arrival times get coarser, the output itself is kept
+    }
+    cmd->chunks = chunks;
+    cmd->chunks_max = chunks_max;
+  }
+  cmd->chunks[cmd->nchunks].at = at;
+  cmd->chunks[cmd->nchunks].offset = offset;
+  cmd->nchunks++;
+}
 
-      buffer[cur_pos] = '\0'; // Ensures that buffer is null-terminated. Can I do this?
+static int strip_crlf(char *buf, int nread, char *before)
+/* Turns each CRLF in the nread bytes just read into buf into a plain
+  newline, including one whose CR ended the previous read: before
+  points at the last byte drained ahead of buf, NULL if none, and
+  such a CR becomes the newline. Programs writing to a terminal often
+  end lines with CRLF themselves. Returns the number of bytes of buf
+  left.
+*/
+{
+  int start = 0;
+  if(buf[0] == '\n' && before != NULL && *before == '\r'){
+    *before = '\n'; // already counted, stands in for the LF
+    start = 1;
+  }
+  int kept = 0;
+  for(int i = start; i < nread; i++){
+    if(buf[i] != '\r' || i+1 == nread || buf[i+1] != '\n'){
+      buf[kept++] = buf[i];
+    }
+  }
+  return kept;
+}
 
-      //free(buffer); // Free allocated buffer?
-      return buffer;
+int cmd_drain(cmd_t *cmd, int block)
+/*
+  Reads output which is available on out_pipe for a running cmd into
+  the segs chain, filling the last segment before taking another from
+  the pool so bytes already read are never moved. If block is 0, stops
+  once no more data is available; otherwise keeps reading until the
+  child closes its output, waiting in poll() as needed. Records the
+  time of the first byte and end of file and picks up the exec time
+  sent by the child over exec_pipe. The arrival time of the data is
+  kept in chunks for output-for --timestamps and --gaps, and the new
+  bytes are checked against any on-output triggers. CRLF becomes a
+  newline for CAPTURE_PTY and the EIO a pty gives once the child has
+  closed it counts as end of file. Bytes past MAX_OUTPUT are read and
+  dropped, with a message at end of file as for a capture file. Stops
+  early if memory for another segment runs out. Returns the number of bytes read.
+*/
+{
+  cmd_read_exec_pipe(cmd);
+  if(cmd->pid == -1 || cmd->output_eof){
+    return 0;
+  }
+  int total = 0;
+  while(1){
+    outseg_t *tail = cmd->segs_tail;
+    outseg_t *seg = tail;
+    if(seg == NULL || seg->len == SEGMENT_SIZE){ // linked in only once it holds data
+      seg = segment_get();
+      if(seg == NULL){
+        return total; // out of memory, the rest stays in the pipe for now
+      }
+    }
+    char *buf = seg->data + seg->len;
+    int nread = read(cmd->out_pipe[PREAD], buf, SEGMENT_SIZE - seg->len);
+    int err = errno;
+    int nkept = nread;
+    if(nread > 0 && cmd->capture == CAPTURE_PTY){
+      char *before = (tail != NULL) ? tail->data + tail->len - 1 : NULL;
+      nkept = strip_crlf(buf, nread, before);
     }
-    else if (bytes_read == -1){
-      perror("Read failed");
-      exit(1); // bail out, friends
+    if(nkept > MAX_OUTPUT - cmd->drained_size){ // keep reading so the child is not blocked, drop the rest
+      cmd->cut_size += nkept - (MAX_OUTPUT - cmd->drained_size);
+      nkept = MAX_OUTPUT - cmd->drained_size;
+    }
+    if(nkept > 0 && seg != tail){
+      if(tail == NULL){
+        cmd->segs = seg;
+      }
+      else{
+        tail->next = seg;
+      }
+      cmd->segs_tail = seg;
+    }
+    else if(seg != tail){
+      segment_release(seg); // nothing read into it
+    }
+    errno = err;
+    if(nread > 0){
+      if(nkept > 0){
+        long long at = now_nanos();
+        if(cmd->drained_size == 0){
+          cmd->times.first_output = at;
+        }
+        record_chunk(cmd, cmd->drained_size, at);
+        cmd_scan_output(cmd, buf, nkept); // on-output triggers
+        seg->len += nkept;
+        cmd->drained_size += nkept;
+        total += nkept;
+        PROBE(output_read, cmd->job, cmd->pid, nkept, cmd->drained_size);
+      }
+    }
+    else if(nread == 0 || (errno == EIO && cmd->capture == CAPTURE_PTY)){ // end of file, child closed its output
+      cmd->output_eof = 1;
+      cmd->times.output_eof = now_nanos();
+      PROBE(output_eof, cmd->job, cmd->pid, cmd->drained_size);
+      if(cmd->cut_size > 0 && !embedded){
+        printf("%s[#%d]: output of %lld bytes cut to %d\n", cmd->name, cmd->pid,
+               cmd->drained_size + cmd->cut_size, MAX_OUTPUT);
+      }
+      return total;
+    }
+    else if(errno == EAGAIN && block){
+      struct pollfd pfd = { .fd = cmd->out_pipe[PREAD], .events = POLLIN };
+      poll(&pfd, 1, -1);
+    }
+    else if(errno != EINTR && errno != EAGAIN){
+      if(!embedded){
+        perror("Read failed");
+      }
+      cmd->output_eof = 1; // give up on the output
+      return total;
+    }
+    else if(errno == EAGAIN){
+      return total; // nothing more for now
     }
   }
 }
@@ -270,44 +928,397 @@ void cmd_fetch_output(cmd_t *cmd)
 
   Otherwise retrieves output from the cmd->out_pipe and fills
   cmd->output setting cmd->output_size to number of bytes in
-  output. Makes use of read_all() to efficiently capture
-  output. Closes the pipe associated with the command after reading
-  all input.
+  output. Makes use of cmd_drain() to read whatever was not already
+  drained while the cmd ran. Output which fits in one segment is
+  copied into cmd->output, a buffer of just its size, and the segment
+  goes back to the pool; larger output stays in the segs chain where
+  it was read, so no more than one segment of it is unused space.
+  Closes the pipe associated with the command after reading all
+  input. For CAPTURE_MEMFD the capture file is mapped into memory
+  instead, again without copying.
+
+  When embedded the drain does not block. If something the cmd left
+  running in the background still holds the pipe open, returns with
+  output_eof still 0, output_size -1 and the pipe open, to be called
+  again whenever the pipe is readable until it reaches end of file.
 */
 {
     if(cmd->finished == 0){ // cmd is not done
-      printf("%s[#%d] not finished yet", cmd->name, cmd->pid);
+      if(!embedded){
+        printf("%s[#%d] not finished yet", cmd->name, cmd->pid);
+      }
       return; // take no further action.
     }
+    else if(cmd->capture_fd != -1){
+      map_capture_file(cmd);
+    }
     else{ // cmd is finished
       // retrieves output from the cmd->out_pipe[PREAD] and fills the cmd->output setting cmd->output_size to number of bytes in output.
-
-      int nread = cmd->output_size;
-      cmd->output = read_all(cmd->out_pipe[PREAD], &nread);
-
-      //printf("nread after read_all returned is %d \n", nread); // debugger
-      cmd->output_size = nread;
+      cmd_drain(cmd, !embedded);
+      if(embedded && !cmd->output_eof){
+        return; // the rest comes later, the host must not block
+      }
+      cmd->output_eof = 1; // all there will be, even if memory ran out first
+      cmd->output_size = cmd->drained_size;
+      if(cmd->segs == NULL){
+        cmd->output = segment_join(NULL, 0); // no output, an empty string
+      }
+      else if(cmd->segs->next == NULL){ // fits in one segment, compact it
+        cmd_join_output(cmd);
+      }
+      cmd->last_used = now_nanos(); // freshly captured output is the last to be evicted
+      cmd->times.captured = now_nanos();
       close(cmd->out_pipe[PREAD]); // make sure to close the pipe
+      if(cmd->exec_pipe != -1){ // child is gone so nothing more can arrive
+        close(cmd->exec_pipe);
+        cmd->exec_pipe = -1;
+      }
     }
 }
 
 void cmd_print_output(cmd_t *cmd)
 /*
-  Prints the output of the cmd contained in the output field if it is
-  non-null. Prints the error message
+  Prints the output of the cmd contained in the output field or its
+  segments if it is in memory. Prints the error message
 
   ls[#17251] : output not ready
 
-  if output is NULL. The message includes the command name and PID.
+  if it is not. The message includes the command name and PID.
 */
 {
-  if(cmd->output != NULL){
-    // prints the output of the cmd
-    // Use a call to write() to put data on the screen. As write() uses file descriptors, make sure to pass STDOUT_FILENO along with the buffer to write and the number of bytes to write
-    write(STDOUT_FILENO, cmd->output, cmd->output_size);
+  if(cmd_output_in_memory(cmd)){
+    // prints the output of the cmd, segments and all, with writev()
+    cmd_write_output(cmd, STDOUT_FILENO, 0);
   }
-  else{ // prints the error message
+  else if(!embedded){ // prints the error message
     printf("%s[#%d] : output not ready\n", cmd->name ,cmd->pid);
 
   }
 }
+
+int cmd_output_in_memory(cmd_t *cmd)
+/*
+  Returns 1 if the output of a finished cmd is held in memory, either
+  in cmd->output or in its segs chain, and 0 if it has not been
+  captured yet or was evicted.
+*/
+{
+  return cmd->output != NULL || (cmd->segs != NULL && cmd->output_size >= 0);
+}
+
+char *cmd_join_output(cmd_t *cmd)
+/*
+  Compacts output held in the segs chain into cmd->output, one
+  null-terminated buffer, for uses which need it in one piece such as
+  feed, and gives the segments back to the pool. Returns cmd->output,
+  NULL if the output is not in memory or there is no memory to join
+  it, in which case it stays in segments.
+*/
+{
+  if(cmd->output == NULL && cmd->segs != NULL && cmd->output_size >= 0){
+    cmd->output = segment_join(cmd->segs, cmd->output_size);
+    if(cmd->output != NULL){
+      segment_release(cmd->segs);
+      cmd->segs = NULL;
+      cmd->segs_tail = NULL;
+    }
+  }
+  return cmd->output;
+}
+
+void cmd_discard_output(cmd_t *cmd)
+// Frees the output of a finished cmd for good, keeping output_size.
+{
+  free_output(cmd);
+}
+
+int cmd_output_header(cmd_t *cmd, char *buf, int bufsize)
+/*
+  Formats the header shown before the output of a cmd into buf such as
+
+  @<<< Output for ls[#17251] (55 bytes):
+  ----------------------------------------
+
+  Returns the length of the header.
+*/
+{
+  int len = snprintf(buf, bufsize, "@<<< Output for %s[#%d] (%d bytes):\n" DIVIDER,
+                     cmd->name, cmd->pid, cmd->output_size);
+  return (len < bufsize) ? len : bufsize-1;
+}
+
+int cmd_write_output(cmd_t *cmd, int fd, int with_header)
+/*
+  Writes the output of cmd to fd, preceded by the output-for header
+  and followed by a divider if with_header is nonzero. The header,
+  output, and divider are handed to the kernel with writev() so large
+  outputs are not copied again in user space; output kept in segments
+  goes SEGMENT_IOV segments per call. Returns 0 on success, -1 if the
+  output is not ready or the write failed.
+*/
+{
+  if(!cmd_output_in_memory(cmd)){
+    return -1;
+  }
+  if(fd == STDOUT_FILENO){
+    fflush(stdout); // buffered text printed before this goes out first
+  }
+  char header[MAX_LINE];
+  struct iovec iov[SEGMENT_IOV+2];
+  int iovcnt = 0;
+  if(with_header){
+    iov[iovcnt].iov_base = header;
+    iov[iovcnt].iov_len = cmd_output_header(cmd, header, sizeof(header));
+    iovcnt++;
+  }
+  if(cmd->output != NULL){
+    iov[iovcnt].iov_base = cmd->output;
+    iov[iovcnt].iov_len = cmd->output_size;
+    iovcnt++;
+  }
+  for(outseg_t *seg = cmd->segs; cmd->output == NULL && seg != NULL; seg = seg->next){
+    if(iovcnt == SEGMENT_IOV+1){ // full but for the divider
+      if(write_all(fd, iov, iovcnt) == -1){
+        return -1;
+      }
+      iovcnt = 0;
+    }
+    iov[iovcnt].iov_base = seg->data;
+    iov[iovcnt].iov_len = seg->len;
+    iovcnt++;
+  }
+  if(with_header){
+    iov[iovcnt].iov_base = DIVIDER;
+    iov[iovcnt].iov_len = strlen(DIVIDER);
+    iovcnt++;
+  }
+  return write_all(fd, iov, iovcnt);
+}
+
+static int copy_spill_file(cmd_t *cmd, int fd)
+/* Copies the evicted output of cmd from its spill file to fd without
+  it passing through user space: copy_file_range() shares or copies
+  the blocks within the filesystem, sendfile() takes over where the
+  files are on different filesystems or fd is not a regular file.
+  Returns 0 on success, -1 with errno set on failure.
+*/
+{
+  int in_fd = open(cmd->spill_file, O_RDONLY | O_CLOEXEC);
+  if(in_fd == -1){
+    return -1;
+  }
+  long long left = cmd->output_size;
+  int use_sendfile = 0;
+  while(left > 0){
+    ssize_t ncopied = use_sendfile ? sendfile(fd, in_fd, NULL, left) :
+                      copy_file_range(in_fd, NULL, fd, NULL, left, 0);
+    if(ncopied == -1 && errno == EINTR){
+      continue;
+    }
+    if(ncopied == -1 && !use_sendfile &&
+       (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP)){
+      use_sendfile = 1; // goes on from the file offsets copy_file_range() left
+      continue;
+    }
+    if(ncopied <= 0){
+      int err = (ncopied == 0) ? EIO : errno; // spill file shorter than the output
+      close(in_fd);
+      errno = err;
+      return -1;
+    }
+    left -= ncopied;
+  }
+  close(in_fd);
+  return 0;
+}
+
+int cmd_save_output(cmd_t *cmd, int fd, int with_header)
+/*
+  Writes the output of cmd to fd like cmd_write_output() does, for
+  save and 'output-for int > file'. Output which was evicted is copied
+  from its spill file by the kernel rather than being read back into
+  memory, where it would push out other outputs to make room. Returns
+  0 on success, -1 if the output is not ready or the write failed.
+*/
+{
+  if(cmd_output_in_memory(cmd) || cmd->spill_file == NULL){
+    return cmd_write_output(cmd, fd, with_header);
+  }
+  char header[MAX_LINE];
+  struct iovec iov = { .iov_base = header };
+  if(with_header){
+    iov.iov_len = cmd_output_header(cmd, header, sizeof(header));
+    if(write_all(fd, &iov, 1) == -1){
+      return -1;
+    }
+  }
+  if(copy_spill_file(cmd, fd) == -1){
+    return -1;
+  }
+  if(with_header){
+    iov = (struct iovec) { .iov_base = DIVIDER, .iov_len = strlen(DIVIDER) };
+    return write_all(fd, &iov, 1);
+  }
+  return 0;
+}
+
+void cmd_print_timed_output(cmd_t *cmd, int timestamps, long long gap_nanos)
+/*
+  Prints the output of cmd like output-for does but showing when it
+  arrived, for 'output-for int --timestamps --gaps MS'. The output
+  must be ready. With timestamps each line is preceded by the seconds
+  from the start of the job to when its first byte was read:
+
+  [   0.002] compiling
+  [  30.118] done
+
+  If gap_nanos is above 0, a line
+
+  @--- 30.116s gap ---
+
+  goes before any line whose output arrived at least gap_nanos after
+  the output before it, or after the start of the job, and at the end
+  if the job was quiet that long before closing its output. Output
+  captured with memfd was not read as it arrived so it is printed
+  plainly after a note saying so.
+*/
+{
+  char header[MAX_LINE];
+  cmd_output_header(cmd, header, sizeof(header));
+  printf("%s", header);
+
+  char *out = cmd_join_output(cmd); // lines may cross segments
+  int size = cmd->output_size;
+  if(out == NULL){
+    printf("%s[#%d] : output not ready\n", cmd->name, cmd->pid);
+    printf(DIVIDER);
+    return;
+  }
+  long long start = cmd->times.fork;
+  outchunk_t *chunks = cmd->chunks;
+  if(cmd->nchunks == 0 && size > 0){
+    printf("@--- no arrival times, output was not read as it arrived ---\n");
+    fwrite(out, 1, size, stdout);
+    printf(DIVIDER);
+    return;
+  }
+
+  int c = 0; // chunk holding pos
+  int pos = 0;
+  while(pos < size){
+    char *nl = memchr(out + pos, '\n', size - pos);
+    int end = (nl != NULL) ? nl - out + 1 : size;
+    while(c+1 < cmd->nchunks && chunks[c+1].offset <= pos){
+      c++;
+    }
+
+    // the longest wait before any chunk which starts in this line
+    long long gap = 0;
+    int k = (chunks[c].offset < pos) ? c+1 : c; // a chunk begun on an earlier line was checked there
+    for(; k < cmd->nchunks && chunks[k].offset < end; k++){
+      long long before = (k == 0) ? start : chunks[k-1].at;
+      if(chunks[k].at - before > gap){
+        gap = chunks[k].at - before;
+      }
+    }
+    if(gap_nanos > 0 && gap >= gap_nanos){
+      printf("@--- %.3fs gap ---\n", gap / 1e9);
+    }
+    if(timestamps){
+      printf("[%8.3f] ", (chunks[c].at - start) / 1e9);
+    }
+    fwrite(out + pos, 1, end - pos, stdout);
+    if(nl == NULL){
+      printf("\n"); // last line had no newline of its own
+    }
+    pos = end;
+  }
+
+  long long last = (cmd->nchunks > 0) ? chunks[cmd->nchunks-1].at : start;
+  if(gap_nanos > 0 && cmd->times.output_eof != 0 && cmd->times.output_eof - last >= gap_nanos){
+    printf("@--- %.3fs gap ---\n", (cmd->times.output_eof - last) / 1e9);
+  }
+  printf(DIVIDER);
+}
+
+int cmd_spill_output(cmd_t *cmd)
+/*
+  Evicts the output of cmd from memory to make room for others. The
+  output is first written to a temporary file under $TMPDIR (or /tmp)
+  unless an earlier eviction already left a copy there; output never
+  changes once captured so that copy is still good. Returns 0 on
+  success and -1 if there is no output in memory or the file could
+  not be written, in which case the output stays in memory.
+*/
+{
+  if(!cmd_output_in_memory(cmd)){
+    return -1;
+  }
+  if(cmd->spill_file == NULL){
+    char *dir = getenv("TMPDIR");
+    char path[MAX_LINE];
+    snprintf(path, sizeof(path), "%s/commando-output-XXXXXX", (dir != NULL) ? dir : "/tmp");
+    int fd = mkostemp(path, O_CLOEXEC);
+    if(fd == -1){
+      perror("Could not evict output");
+      return -1;
+    }
+    if(cmd_write_output(cmd, fd, 0) == -1){
+      perror("Could not evict output");
+      close(fd);
+      unlink(path);
+      return -1;
+    }
+    close(fd);
+    cmd->spill_file = strdup(path);
+  }
+  free_output(cmd); // output_size is kept for list and the header
+  return 0;
+}
+
+int cmd_load_output(cmd_t *cmd)
+/*
+  Reads the output of cmd back into memory from its spill file if it
+  was evicted. The file is kept so evicting it again costs
+  nothing. Returns 0 if the output is now in memory and -1 otherwise,
+  such as when the cmd has not finished.
+*/
+{
+  if(cmd_output_in_memory(cmd)){
+    return 0;
+  }
+  if(cmd->spill_file == NULL){
+    return -1;
+  }
+  int fd = open(cmd->spill_file, O_RDONLY | O_CLOEXEC);
+  if(fd == -1){
+    perror(cmd->spill_file);
+    return -1;
+  }
+  char *buf = malloc(cmd->output_size + 1);
+  if(buf == NULL){
+    printf("%s[#%d]: no memory to load output of %d bytes\n", cmd->name, cmd->pid, cmd->output_size);
+    close(fd);
+    return -1;
+  }
+  int nread = 0;
+  while(nread < cmd->output_size){
+    int n = read(fd, buf + nread, cmd->output_size - nread);
+    if(n == -1 && errno == EINTR){
+      continue;
+    }
+    if(n <= 0){
+      break;
+    }
+    nread += n;
+  }
+  close(fd);
+  if(nread != cmd->output_size){
+    printf("%s: truncated spill file for %s[#%d]\n", cmd->spill_file, cmd->name, cmd->pid);
+    free(buf);
+    return -1;
+  }
+  buf[nread] = '\0'; // outputs are always null terminated
+  cmd->output = buf;
+  return 0;
+}
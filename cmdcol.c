@@ -2,24 +2,350 @@
 
 #include "commando.h"
 
-void cmdcol_add(cmdcol_t *col, cmd_t *cmd)
+int cmdcol_add(cmdcol_t *col, cmd_t *cmd)
 /* Add the given cmd to the col structure. Update the cmd[] array and
-  size field. Report an error if adding would cause size to exceed
-  MAX_CMDS, the maximum number commands supported.
+  size field. The array starts with room for MAX_CMDS commands and
+  doubles whenever it fills so there is no limit on the number of
+  jobs other than memory. The cmd takes on the capture mode of col
+  unless that is the default CAPTURE_PIPE. The job number also goes on
+  the live list which the state sweeps walk instead of every job, and
+  the job gets a row in col->rows.
+  Returns the job number, or -1 if memory runs out in which case cmd
+  is not added and still belongs to the caller.
 */
 {
-  if(col->size < MAX_CMDS){ // check to make sure size is within bounds
+  if(col->size == col->capacity){ // grow the array if it is full
+    int capacity = (col->capacity == 0) ? MAX_CMDS : 2*col->capacity;
+    cmd_t **cmds = realloc(col->cmd, capacity * sizeof(cmd_t *));
+    if(cmds == NULL){
+      return -1;
+    }
+    col->cmd = cmds; // the larger array is kept even if live cannot grow
+    int *live = realloc(col->live, capacity * sizeof(int)); // nlive <= size so it grows alongside
+    if(live == NULL){
+      return -1;
+    }
+    col->live = live;
+    cmdrow_t *rows = realloc(col->rows, capacity * sizeof(cmdrow_t));
+    if(rows == NULL){
+      return -1;
+    }
+    col->rows = rows;
+    col->capacity = capacity;
+  }
+
+  if(col->capture != CAPTURE_PIPE){
+    cmd->capture = col->capture; // new jobs use the capture mode of the session
+  }
+
+  // Add the given cmd to the col structure.
+  col->cmd[col->size] = cmd;
+  cmd->job = col->size;
+  PROBE(cmdcol_add, cmd->job, cmd->name, col->nlive);
+  col->live[col->nlive++] = col->size; // new job numbers are the largest so live stays sorted
+
+  // increment temp_size after given cmd is added to col struct
+  col->size = col->size + 1; // Update size to the the updated size
+  cmdcol_sync(col, cmd->job);
+  return cmd->job;
+}
+
+cmd_t *cmdcol_get(cmdcol_t *col, char *job_str)
+/* Look up the cmd for the job number given as a string such as a
+  token typed at the prompt. Prints an error message and returns
+  NULL if job_str is missing, not a number, or out of range.
+*/
+{
+  char *end = NULL;
+  long job_num = (job_str != NULL) ? strtol(job_str, &end, 10) : -1;
+  if(job_str == NULL || *end != '\0' || job_num < 0 || job_num >= col->size){
+    printf("No job %s\n", (job_str != NULL) ? job_str : "given");
+    return NULL;
+  }
+  return col->cmd[job_num];
+}
+
+int cmdcol_add_group(cmdcol_t *col, int first, int count)
+/* Record the count jobs starting at job number first as a group so
+  they can be referred to together as gN. Returns the group number or
+  -1 if memory runs out.
+*/
+{
+  cmdgroup_t *groups = realloc(col->groups, (col->ngroups+1) * sizeof(cmdgroup_t));
+  if(groups == NULL){
+    return -1;
+  }
+  col->groups = groups;
+  col->groups[col->ngroups].first = first;
+  col->groups[col->ngroups].count = count;
+  col->ngroups++;
+  return col->ngroups - 1;
+}
+
+cmdgroup_t *cmdcol_get_group(cmdcol_t *col, char *group_str)
+/* Look up a group given as a string like "g2". Returns NULL without
+  printing anything if group_str does not name a group so callers can
+  fall back to treating it as a job number.
+*/
+{
+  if(group_str == NULL || group_str[0] != 'g'){
+    return NULL;
+  }
+  char *end = NULL;
+  long group_num = strtol(group_str+1, &end, 10);
+  if(end == group_str+1 || *end != '\0' || group_num < 0 || group_num >= col->ngroups){
+    return NULL;
+  }
+  return &col->groups[group_num];
+}
+
+void cmdcol_sync(cmdcol_t *col, int job)
+/* Copies the fields of the cmd of job which col->rows holds into its
+  row. Called whenever they may have changed: compact_live() does so
+  for every live job before each sweep, and only live jobs change.
+*/
+{
+  cmd_t *cmd = col->cmd[job];
+  cmdrow_t *row = &col->rows[job];
+  row->pid = cmd->pid;
+  row->status = cmd->status;
+  row->output_size = cmd->output_size;
+  row->finished = cmd->finished;
+  memcpy(row->str_status, cmd->str_status, sizeof(row->str_status));
+}
+
+static int deps_state(cmdcol_t *col, cmd_t *cmd)
+/* Checks the jobs cmd must run after. Returns 1 if they have all
+  finished as required, 0 if some are still running, and -1 if cmd can
+  never run because it needs EXIT(0) and a job finished otherwise.
+  Reads the rows of the jobs, which must be in sync.
+*/
+{
+  int ready = 1;
+  for(int i = 0; i < cmd->nafter; i++){
+    cmdrow_t *dep = &col->rows[cmd->after[i]];
+    if(!dep->finished){
+      ready = 0;
+    }
+    else if(cmd->after_ok && dep->status != 0){
+      return -1;
+    }
+  }
+  return ready;
+}
+
+static void compact_live(cmdcol_t *col)
+/* Brings the rows of the jobs on col->live up to date and drops those
+  which have finished, keeping the rest in job number order. A job
+  only finishes once so it never needs to be put back, and its row
+  is final from then on. Finished jobs make up nearly all of a long
+  session and this keeps the sweeps over running jobs from touching
+  them at all.
+*/
+{
+  int n = 0;
+  for(int i = 0; i < col->nlive; i++){
+    cmdcol_sync(col, col->live[i]);
+    if(!col->rows[col->live[i]].finished){
+      col->live[n++] = col->live[i];
+    }
+  }
+  col->nlive = n;
+}
+
+static int col_has_running(cmdcol_t *col)
+/* Returns 1 if any job in col has been started and not finished.
+*/
+{
+  for(int i = 0; i < col->nlive; i++){
+    cmd_t *cmd = col->cmd[col->live[i]];
+    if(cmd->pid != -1 && !cmd->finished){
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int cmdcol_schedule(cmdcol_t *col)
+/* Start jobs which have not been started yet in job number order
+  once the jobs they run after have finished and while fewer than
+  col->max_running jobs are running; a max_running of 0 starts
+  everything that is ready. Jobs whose required jobs did not EXIT(0)
+  are marked DEP-FAIL and finished without running. Called after
+  every change so each job starts as soon as it can. If commando runs
+  out of file descriptors or processes, the remaining jobs stay queued
+  and are started by a later call once running jobs finish. Returns
+  the number of jobs still waiting to start.
+*/
+{
+  compact_live(col);
+  int running = 0, queued = 0, starved = 0;
+  for(int i = 0; i < col->nlive; i++){
+    if(col->rows[col->live[i]].pid != -1){
+      running++;
+    }
+  }
+  for(int i = 0; i < col->nlive; i++){
+    int job = col->live[i];
+    if(col->rows[job].pid != -1 || col->rows[job].finished){
+      continue;
+    }
+    cmd_t *cmd = col->cmd[job];
+    int deps = deps_state(col, cmd);
+    if(deps == -1){
+      cmd->finished = 1;
+      snprintf(cmd->str_status, STATUS_LEN+1, "DEP-FAIL");
+      cmdcol_sync(col, job); // jobs after this one may depend on it
+      cmd_alert(cmd, cmd->str_status);
+      continue;
+    }
+    if(deps == 0 || starved || (col->max_running > 0 && running >= col->max_running)){
+      queued++;
+      continue;
+    }
+    if(cmd_start(cmd) == -1){
+      starved = 1; // out of fds or processes, later starts would fail too
+      queued++;
+      continue;
+    }
+    cmdcol_sync(col, job);
+    running++;
+  }
+  return queued;
+}
 
-    // Add the given cmd to the col structure.
-    col->cmd[col->size] = cmd;
+void cmdcol_wait_for(cmdcol_t *col, cmd_t *cmd)
+/* Block until cmd finishes or is stopped. If no jobs are waiting to start
+  and no on-output triggers are watching other jobs this is just a
+  blocking cmd_update_state(). Otherwise waits in cmdcol_poll() which
+  keeps draining output of all running jobs and starts queued jobs as
+  others finish so the rest of the jobs keep running while waiting.
+*/
+{
+  fflush(stdout); // show what was printed so far while blocked
+  while(!cmd->finished){
+    if(cmd->stopped){ // would never finish, let the user cont it
+      printf("%s[#%d] is stopped\n", cmd->name, cmd->pid);
+      return;
+    }
+    if(cmdcol_schedule(col) == 0 && !cmdcol_watching(col)){
+      cmd_update_state(cmd, DOBLOCK);
+      cmdcol_enforce_budget(col, NULL);
+      return;
+    }
+    if(!col_has_running(col)){
+      return; // nothing left which could let cmd start
+    }
+    cmdcol_poll(col, -1, NULL, -1);
+  }
+}
 
-    // increment temp_size after given cmd is added to col struct
-    col->size = col->size + 1; // Update size to the the updated size
+static char *replace_braces(char *tok, char *arg)
+/* Returns a newly allocated copy of tok with every {} replaced by arg
+  or NULL if tok has no {} in it.
+*/
+{
+  if(strstr(tok, "{}") == NULL){
+    return NULL;
   }
-  else{
-    perror("Size is larger than MAX_CMDS. Cannot be added. Exiting.");
-    exit(1);
+  char *result = malloc(strlen(tok) * (strlen(arg)+1) + 1); // enough for every char being {}
+  char *dst = result;
+  while(*tok != '\0'){
+    if(tok[0] == '{' && tok[1] == '}'){
+      strcpy(dst, arg);
+      dst += strlen(arg);
+      tok += 2;
+    }
+    else{
+      *dst++ = *tok++;
+    }
   }
+  *dst = '\0';
+  return result;
+}
+
+int cmdcol_map(cmdcol_t *col, char *tokens[])
+/* Handles 'map cmd arg {} ::: a b c' where tokens[] starts at cmd.
+  Adds one job per argument after the ::: with {} in the command
+  replaced by that argument, or the argument appended if there is no
+  {}. The jobs are grouped and started by cmdcol_schedule() so they
+  honor the limit on running jobs. Returns the group number or -1 if
+  the tokens are malformed or memory runs out, though the jobs added
+  by then still run.
+*/
+{
+  int sep = 0;
+  while(tokens[sep] != NULL && strcmp(tokens[sep], ":::") != 0){
+    sep++;
+  }
+  if(sep == 0 || tokens[sep] == NULL || tokens[sep+1] == NULL){
+    return -1;
+  }
+  int first = col->size;
+  int count = 0;
+  for(int a = sep+1; tokens[a] != NULL; a++){
+    char *argv[ARG_MAX+1];
+    char *subst[ARG_MAX+1];     // strings allocated for this job's argv
+    int argc = 0, replaced = 0;
+    for(int t = 0; t < sep && argc < ARG_MAX-1; t++){
+      subst[t] = replace_braces(tokens[t], tokens[a]);
+      replaced |= (subst[t] != NULL);
+      argv[argc++] = (subst[t] != NULL) ? subst[t] : tokens[t];
+    }
+    if(!replaced){
+      argv[argc++] = tokens[a];
+    }
+    argv[argc] = NULL;
+    cmd_t *cmd = cmd_new(argv); // cmd_new() makes its own copies
+    int added = cmdcol_add(col, cmd);
+    for(int t = 0; t < sep && t < ARG_MAX-1; t++){
+      free(subst[t]);
+    }
+    if(added == -1){
+      cmd_free(cmd);
+      break;
+    }
+    count++;
+  }
+  int group = (count > 0) ? cmdcol_add_group(col, first, count) : -1;
+  cmdcol_schedule(col);
+  return group;
+}
+
+int cmdcol_after(cmdcol_t *col, char *deps_str, char *argv[], int after_ok)
+/* Handles 'after 3,5 cmd args' and 'after-ok 3,5 cmd args'. Adds a job
+  for argv[] which cmdcol_schedule() starts once jobs 3 and 5 finish
+  (with EXIT(0) for after-ok). Jobs may only depend on jobs that
+  already exist so the dependencies can never form a cycle. Returns
+  the new job number or -1 after printing an error, or without one if
+  memory runs out.
+*/
+{
+  int after[ARG_MAX];
+  int nafter = 0;
+  char *pos = deps_str;
+  while(pos != NULL && *pos != '\0' && nafter < ARG_MAX){
+    char *end = NULL;
+    long job_num = strtol(pos, &end, 10);
+    if(end == pos || (*end != ',' && *end != '\0') || job_num < 0 || job_num >= col->size){
+      printf("No job %.*s\n", (int) strcspn(pos, ","), pos);
+      return -1;
+    }
+    after[nafter++] = job_num;
+    pos = (*end == ',') ? end+1 : end;
+  }
+  if(nafter == 0 || argv[0] == NULL){
+    printf("usage: after int,int,... cmd arg1 ...\n");
+    return -1;
+  }
+  cmd_t *cmd = cmd_new(argv);
+  cmd_set_after(cmd, after, nafter, after_ok);
+  if(cmdcol_add(col, cmd) == -1){
+    cmd_free(cmd);
+    return -1;
+  }
+  cmdcol_schedule(col);
+  return cmd->job;
 }
 
 void cmdcol_print(cmdcol_t *col)
@@ -41,40 +367,385 @@ void cmdcol_print(cmdcol_t *col)
 
   The final field should be the contents of cmd->argv[] with a space
   between each element of the array.
+
+  When there is an output budget a RES column after OUTB shows where
+  each output lives: mem if it is held in memory, disk if it was
+  evicted to its spill file, and - if there is no output yet.
+
+  The numbers and status come from col->rows; each cmd is only read
+  for its argv, and for where its output lives with a budget.
 */
 {
+  compact_live(col); // rows of live jobs may have changed since the last sweep
   // print labels on top
-  printf("%-4s %-8s %4s %10s %4s %s\n", "JOB", "#PID", "STAT", "STR_STAT", "OUTB", "COMMAND");
+  printf("%-4s %-8s %4s %10s %4s ", "JOB", "#PID", "STAT", "STR_STAT", "OUTB");
+  if(col->output_budget > 0){
+    printf("%-4s ", "RES");
+  }
+  printf("%s\n", "COMMAND");
   // use for loop to print row by row
   for(int i = 0; i < col->size; i++){
-    printf("%-4d #%-8d %4d %10s %4d ", i, col->cmd[i]->pid, col->cmd[i]->status, col->cmd[i]->str_status, col->cmd[i]->output_size);
+    cmdrow_t *row = &col->rows[i];
+    printf("%-4d #%-8d %4d %10s %4d ", i, row->pid, row->status, row->str_status, row->output_size);
+    if(col->output_budget > 0){
+      char *res = cmd_output_in_memory(col->cmd[i]) ? "mem" : (col->cmd[i]->spill_file != NULL) ? "disk" : "-";
+      printf("%-4s ", res);
+    }
 
-    // print the last string argv
-    int j = 0, k = 0;
-    while(col->cmd[i]->argv[j + k] != NULL){
-      printf("%s ", col->cmd[i]->argv[j + k]);
-      k++;
+    // print the last string argv, copied as is rather than through printf()
+    for(char **arg = col->cmd[i]->argv; *arg != NULL; arg++){
+      fputs(*arg, stdout);
+      putchar(' ');
     }
-    printf("\n"); // Enter new space, and start new print line
+    putchar('\n'); // Enter new space, and start new print line
   }
 }
 
-void cmdcol_update_state(cmdcol_t *col, int nohang)
+int cmdcol_update_state(cmdcol_t *col, int nohang)
 /* Update each cmd in col by calling cmd_update_state() which is also
-  passed the block argument (either NOBLOCK or DOBLOCK)
+  passed the block argument (either NOBLOCK or DOBLOCK). Returns the
+  number of cmds which finished during the update. Only the jobs on
+  the live list are visited; finished jobs cannot change state.
+
+  With a wake_fd, a NOBLOCK update first empties it and skips the
+  sweep over the jobs entirely if no SIGCHLD arrived since the last
+  one: nothing can have changed state, and calling waitpid() on
+  thousands of running jobs at every prompt would dominate. Jobs for
+  on-output triggers which fired since the last update are added
+  first either way.
 */
 {
+  cmdcol_run_triggers(col);
+  if(col->wake_fd > 0 && nohang == NOBLOCK){
+    char drain[64];
+    int nwoken = 0, nread;
+    while((nread = read(col->wake_fd, drain, sizeof(drain))) > 0){
+      nwoken += nread;
+    }
+    if(nwoken == 0){
+      return 0;
+    }
+  }
+  int nfinished = 0;
+  for(int i = 0; i < col->nlive; i++){
+    cmd_t *cmd = col->cmd[col->live[i]];
+    int was_finished = cmd->finished;
+    cmd_update_state(cmd, nohang); // Is this all I have to do?
+    nfinished += (cmd->finished && !was_finished);
+  }
+  if(nfinished > 0){
+    compact_live(col);
+    cmdcol_enforce_budget(col, NULL); // newly captured outputs may push memory over budget
+  }
+  return nfinished;
+}
+
+static int compare_pointers(const void *a, const void *b)
+{
+  char *pa = *(char **) a, *pb = *(char **) b;
+  return (pa > pb) - (pa < pb);
+}
+
+static int compare_last_used(const void *a, const void *b)
+{
+  long long ta = (*(cmd_t **) a)->last_used, tb = (*(cmd_t **) b)->last_used;
+  return (ta > tb) - (ta < tb);
+}
+
+static int pinned_outputs(cmdcol_t *col, void ***pinned)
+/* Collects the buffers which jobs yet to start will be fed with feed
+  into a malloc()'d array sorted for bsearch(); a waiting job borrows
+  the buffer so it cannot be evicted. Returns the number collected, or
+  -1 if there is no memory for the array.
+*/
+{
+  *pinned = malloc((col->nlive + 1) * sizeof(void *));
+  if(*pinned == NULL){
+    return -1;
+  }
+  int npinned = 0;
+  for(int i = 0; i < col->nlive; i++){ // a job yet to start is still live
+    cmd_t *waiting = col->cmd[col->live[i]];
+    if(waiting->pid == -1 && waiting->input != NULL){
+      (*pinned)[npinned++] = waiting->input;
+    }
+  }
+  qsort(*pinned, npinned, sizeof(void *), compare_pointers);
+  return npinned;
+}
+
+void cmdcol_enforce_budget(cmdcol_t *col, cmd_t *keep)
+/* Evicts outputs from memory with cmd_spill_output() while the total
+  size of outputs held in memory is over col->output_budget. The least
+  recently used output, by capture or by viewing, goes first. The
+  output of keep, which may be NULL, is never evicted nor is one a
+  waiting feed job will read. Does nothing when there is no budget.
+
+  Takes one pass over the jobs to total what is in memory. Only if
+  that is over budget are the outputs which may go sorted by last use
+  and evicted in that order, so a call costs O(jobs) plus a sort of
+  the candidates however many are evicted.
+*/
+{
+  if(col->output_budget <= 0){
+    return;
+  }
+  long long resident = 0;
+  int nresident = 0;
   for(int i = 0; i < col->size; i++){
-    cmd_update_state(col->cmd[i], nohang); // Is this all I have to do?
+    if(cmd_output_in_memory(col->cmd[i])){
+      resident += col->cmd[i]->output_size;
+      nresident++;
+    }
+  }
+  if(resident <= col->output_budget){
+    return;
+  }
+  void **pinned;
+  int npinned = pinned_outputs(col, &pinned);
+  cmd_t **victims = malloc(nresident * sizeof(cmd_t *));
+  if(npinned == -1 || victims == NULL){
+    free(pinned);
+    free(victims);
+    return; // stay over budget until memory is found
+  }
+  int nvictims = 0;
+  for(int i = 0; i < col->size; i++){
+    cmd_t *cmd = col->cmd[i];
+    if(cmd_output_in_memory(cmd) && cmd != keep &&
+       (cmd->output == NULL || bsearch(&cmd->output, pinned, npinned, sizeof(void *), compare_pointers) == NULL)){
+      victims[nvictims++] = cmd;
+    }
   }
+  qsort(victims, nvictims, sizeof(cmd_t *), compare_last_used);
+  for(int v = 0; v < nvictims && resident > col->output_budget; v++){
+    if(cmd_spill_output(victims[v]) == -1){
+      break; // the disk is no better for the next one, stay over budget for now
+    }
+    resident -= victims[v]->output_size;
+  }
+  free(pinned);
+  free(victims);
+}
 
+int cmdcol_use_output(cmdcol_t *col, cmd_t *cmd)
+/* Prepares the output of cmd to be shown or saved: reloads it if it
+  was evicted, marks it as the most recently used, and evicts others
+  if that pushed memory over budget. Returns 0 if cmd->output is ready
+  to use and -1 if not, e.g. if cmd has not finished.
+*/
+{
+  if(cmd_load_output(cmd) == -1){
+    return -1;
+  }
+  cmd->last_used = now_nanos();
+  cmdcol_enforce_budget(col, cmd);
+  return 0;
+}
+
+int cmdcol_poll(cmdcol_t *col, int extra_fd, int *extra_ready, int timeout)
+/* Sleeps in poll() until a running job produces output, a child
+  exits (col->wake_fd becomes readable), or extra_fd, such as standard
+  input, becomes readable; extra_fd may be -1. Sleeps at most timeout
+  ms, or without limit if timeout is -1. Drains output from the
+  jobs with data, then updates the state of all jobs without blocking.
+  Without a wake_fd, exits are checked for every 10ms. Sets
+  *extra_ready if extra_fd is readable and returns the number of jobs
+  which finished.
+*/
+{
+  struct pollfd *fds = malloc((col->nlive + 2) * sizeof(struct pollfd));
+  cmd_t **owners = malloc((col->nlive + 2) * sizeof(cmd_t *));
+  int nfds = 0;
+  for(int i = 0; i < col->nlive; i++){
+    cmd_t *cmd = col->cmd[col->live[i]];
+    if(cmd->pid != -1 && !cmd->finished && !cmd->output_eof){
+      fds[nfds] = (struct pollfd) { .fd = cmd->out_pipe[PREAD], .events = POLLIN };
+      owners[nfds++] = cmd;
+    }
+  }
+  int wake_at = -1, extra_at = -1;
+  if(col->wake_fd > 0){
+    wake_at = nfds;
+    fds[nfds++] = (struct pollfd) { .fd = col->wake_fd, .events = POLLIN };
+  }
+  if(extra_fd >= 0){
+    extra_at = nfds;
+    fds[nfds++] = (struct pollfd) { .fd = extra_fd, .events = POLLIN };
+  }
+
+  if(wake_at == -1 && (timeout == -1 || timeout > 10)){
+    timeout = 10;
+  }
+  int ready = poll(fds, nfds, timeout);
+  for(int i = 0; ready > 0 && i < nfds; i++){
+    if(fds[i].revents == 0){
+      continue;
+    }
+    if(i != wake_at && i != extra_at){ // wake_fd is emptied by cmdcol_update_state()
+      cmd_drain(owners[i], 0);
+    }
+  }
+  if(extra_ready != NULL){
+    *extra_ready = (extra_at != -1 && ready > 0 && fds[extra_at].revents != 0);
+  }
+  free(fds);
+  free(owners);
+  return cmdcol_update_state(col, NOBLOCK);
+}
+
+int cmdcol_signal(cmdcol_t *col, char *job_str, int sig)
+/* Sends sig to the process group of the job given by job_str for
+  kill, stop and cont, so whatever the job started gets it too. The
+  change of state is picked up and reported by the next update. Prints
+  an error and returns -1 if the job does not exist, has not started
+  or has already finished; returns 0 otherwise.
+*/
+{
+  cmd_t *cmd = cmdcol_get(col, job_str);
+  if(cmd == NULL){
+    return -1;
+  }
+  if(cmd->pid == -1){
+    printf("%s has not started\n", cmd->name);
+    return -1;
+  }
+  if(cmd->finished){
+    printf("%s[#%d] has already finished\n", cmd->name, cmd->pid);
+    return -1;
+  }
+  if(kill(-cmd->pid, sig) == -1 && kill(cmd->pid, sig) == -1){ // no group if the child has not got to setpgid()
+    perror("kill");
+    return -1;
+  }
+  return 0;
+}
+
+int cmdcol_watching(cmdcol_t *col)
+/* Returns 1 if a job in col which has not finished has on-output
+  triggers which have not fired, so its output should be drained as
+  it arrives even while commando waits for input.
+*/
+{
+  for(int i = 0; i < col->nlive; i++){
+    cmd_t *cmd = col->cmd[col->live[i]];
+    if(!cmd->finished && cmd_watching(cmd)){
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void signal_running(cmdcol_t *col, int sig)
+// Sends sig to the process group of every running job, so whatever
+// a job started goes too, then SIGCONT so stopped jobs act on it.
+{
+  for(int i = 0; i < col->nlive; i++){
+    cmd_t *cmd = col->cmd[col->live[i]];
+    if(cmd->pid == -1 || cmd->finished){
+      continue;
+    }
+    if(kill(-cmd->pid, sig) == -1){ // no group if the child has not got to setpgid()
+      kill(cmd->pid, sig);
+    }
+    if(sig != SIGKILL){
+      kill(-cmd->pid, SIGCONT);
+    }
+  }
+}
+
+static void continue_stopped(cmdcol_t *col)
+// Sends SIGCONT to the process group of every stopped job.
+{
+  for(int i = 0; i < col->nlive; i++){
+    cmd_t *cmd = col->cmd[col->live[i]];
+    if(cmd->pid != -1 && !cmd->finished && cmd->stopped){
+      if(kill(-cmd->pid, SIGCONT) == -1){
+        kill(cmd->pid, SIGCONT);
+      }
+    }
+  }
+}
+
+static void wait_until(cmdcol_t *col, long long deadline, int start_queued)
+/* Reaps jobs as they finish, draining the output of all of them in
+  one poll() so none stalls on a full pipe, until no job is running or
+  the deadline from now_nanos() passes; a deadline of -1 waits as long
+  as it takes, continuing stopped jobs since they would never finish
+  otherwise. With start_queued, jobs waiting to start are started as
+  slots free up, as they would be at the prompt, but none once the
+  deadline has passed.
+*/
+{
+  while(1){
+    int timeout = -1;
+    if(deadline != -1){
+      long long left = deadline - now_nanos();
+      if(left <= 0){
+        return;
+      }
+      timeout = (left + 999999) / 1000000; // round up so the loop does not spin
+    }
+    if(start_queued){
+      cmdcol_schedule(col);
+    }
+    if(!col_has_running(col)){
+      return;
+    }
+    if(deadline == -1){
+      continue_stopped(col);
+    }
+    cmdcol_poll(col, -1, NULL, timeout);
+  }
+}
+
+int cmdcol_shutdown(cmdcol_t *col, int term_after, int kill_after)
+/* Ends the jobs in col before commando exits rather than leaving them
+  orphaned with their output pipes closed under them. Jobs have
+  term_after ms to finish by themselves, or forever if term_after is
+  -1, during which queued jobs still start; stopped jobs are
+  continued when waiting forever. The process groups of
+  those still running then get SIGTERM and, kill_after ms later,
+  SIGKILL; a kill_after of 0 skips straight to SIGKILL. Every job is
+  signalled before any is waited for and all share one deadline, so
+  unless term_after is -1 shutdown takes at most term_after +
+  kill_after ms however many jobs there are. Jobs still queued once
+  term_after has passed are never started. Each job reaped gets its usual alert and status so
+  a trace written afterwards is complete. Returns the number of jobs
+  which had to be signalled.
+*/
+{
+  cmdcol_update_state(col, NOBLOCK);
+  if(term_after != 0){
+    wait_until(col, (term_after == -1) ? -1 : now_nanos() + term_after * 1000000LL, 1);
+  }
+  int nsignalled = 0;
+  for(int i = 0; i < col->nlive; i++){
+    cmd_t *cmd = col->cmd[col->live[i]];
+    nsignalled += (cmd->pid != -1 && !cmd->finished);
+  }
+  if(nsignalled == 0){
+    return 0;
+  }
+  if(kill_after > 0){
+    signal_running(col, SIGTERM);
+    wait_until(col, now_nanos() + kill_after * 1000000LL, 0);
+  }
+  signal_running(col, SIGKILL);
+  wait_until(col, -1, 0); // SIGKILL cannot be caught, so this is quick
+  return nsignalled;
 }
 
 void cmdcol_freeall(cmdcol_t *col)
-/* Call cmd_free() on all of the constituent cmd_t's.
+/* Call cmd_free() on all of the constituent cmd_t's and free the
+  cmd array, live list and groups.
 */
 {
   for (int i = 0; i < col->size; i++){
     cmd_free(col->cmd[i]);
   }
+  free(col->cmd);
+  free(col->rows);
+  free(col->live);
+  free(col->groups);
 }
@@ -10,8 +10,102 @@
 
 #include "commando.h"
 
+static void save_output(cmd_t *cmd, char *path, int with_header)
+/*
+  Writes the output of cmd to the file at path for 'save' and
+  'output-for int > file', creating or truncating the file. Reports
+  errors instead of creating a file when the output is not ready.
+  Evicted output is copied from its spill file without being loaded.
+*/
+{
+  if(path == NULL){
+    printf("usage: save int file\n");
+    return;
+  }
+  if(!cmd_output_in_memory(cmd) && cmd->spill_file == NULL){
+    cmd_print_output(cmd); // reports output not ready
+    return;
+  }
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if(fd == -1 || cmd_save_output(cmd, fd, with_header) == -1){
+    perror(path);
+  }
+  if(fd != -1){
+    close(fd);
+  }
+}
+
+static int sigchld_pipe[2] = {-1, -1}; // written to when a child changes state
+
+static void sigchld_handler(int sig)
+/*
+  Wakes up cmdcol_poll() when a child exits by writing a byte to
+  sigchld_pipe. Only async-signal-safe calls are made here.
+*/
+{
+  int saved_errno = errno;
+  write(sigchld_pipe[PWRITE], "c", 1); // pipe is non-blocking, a full pipe is already a wakeup
+  errno = saved_errno;
+}
+
+static void wait_for_input(cmdcol_t *col)
+/*
+  Returns once a line of input is ready. While jobs are waiting to
+  start, waits in cmdcol_poll() on standard input along with the jobs
+  so that when a job finishes, the jobs waiting on it are started right
+  away rather than at the next line of input. The same goes while
+  on-output triggers are watching jobs so their output is scanned as
+  it arrives. Reprints the prompt after any alerts are printed.
+*/
+{
+  while((cmdcol_schedule(col) > 0 || cmdcol_watching(col)) && !line_ready()){
+    int input_ready = 0;
+    if(cmdcol_poll(col, STDIN_FILENO, &input_ready, -1) > 0){
+      printf("@> ");
+      fflush(stdout); // show alerts now rather than at the next line of input
+    }
+    if(input_ready){
+      return; // input (or end of input) is ready
+    }
+  }
+}
+
+static void print_group_output(cmdcol_t *col, cmdgroup_t *group, char *name)
+/*
+  Prints the outputs of all members of a group one after another in
+  job order under a single header. Each member is printed as soon as
+  it finishes while later members keep running in the background.
+*/
+{
+  printf("@<<< Output for group %s (%d jobs):\n", name, group->count);
+  printf(DIVIDER);
+  for(int i = group->first; i < group->first + group->count; i++){
+    cmdcol_wait_for(col, col->cmd[i]);
+    cmdcol_use_output(col, col->cmd[i]); // bring back if evicted
+    cmd_print_output(col->cmd[i]);
+  }
+  printf(DIVIDER);
+}
+
+static int add_job(cmdcol_t *col, cmd_t *cmd)
+// Adds cmd to col as a new job. If memory has run out, says so and
+// frees cmd instead. Returns the job number or -1.
+{
+  int job = cmdcol_add(col, cmd);
+  if(job == -1){
+    printf("%s: no memory for another job\n", cmd->name);
+    cmd_free(cmd);
+  }
+  return job;
+}
+
 int main(int argc, char *argv[]){
-  setvbuf(stdout, NULL, _IONBF, 0); // Turn off output buffering
+  // Fully buffer output so a builtin like list costs a few write()
+  // calls rather than one per printf(). The buffer is flushed at the
+  // prompt, before blocking, and before output of jobs is written
+  // directly to STDOUT_FILENO so everything stays in order.
+  static char stdout_buf[OUTBUF_SIZE];
+  setvbuf(stdout, stdout_buf, _IOFBF, sizeof(stdout_buf));
   // check and set environment variables via the standard getenv() and setenv() fumctions
 
   char *echo = getenv("COMMANDO_ECHO"); // returns a pointer to a value associated with name, NULL if not found
@@ -25,71 +119,123 @@ int main(int argc, char *argv[]){
   "output-for", // 4
   "output-all", // 5
   "wait-for", // 6
-  "wait-all"}; // 7
+  "wait-all", // 7
+  "feed", // 8, from here on matched exactly as names like hashdeep or
+           // savelog start other commands; those above are prefixes
+  "save", // 9
+  "map", // 10
+  "max-jobs", // 11
+  "after-ok", // 12
+  "after", // 13
+  "stats", // 14
+  "trace-dump", // 15
+  "kill", // 16
+  "stop", // 17
+  "cont", // 18
+  "capture", // 19
+  "hash", // 20
+  "on-output", // 21
+  "run", // 22
+  "bench", // 23
+  "reexec"}; // 24
 
   char buffer[MAX_LINE]; // Fixed character buffer used to read in input
   char *tokens[ARG_MAX+1];
   int ntoks;
   char *input = NULL;
+  int end_of_input = 0;
+  int term_after = 0;                 // ms jobs get to finish at exit before SIGTERM, -1 to wait for them
+  int kill_after = SHUTDOWN_KILL_MS;  // ms after SIGTERM before SIGKILL, 0 for SIGKILL at once
 
   // It makes better sense to put this in the while loop, because every time it loops it's getting a new cmd until exit, but can't free if not outside of while loop
 
-  cmdcol_t *new_cmdcol = malloc(sizeof(cmdcol_t)); // There is only one of this!!
-  new_cmdcol->size = 0; //initialize size to 0
+  // Each running job holds a couple of fds; allow as many as the hard limit does
+  struct rlimit nofile;
+  if(getrlimit(RLIMIT_NOFILE, &nofile) == 0 && nofile.rlim_cur < nofile.rlim_max){
+    nofile.rlim_cur = nofile.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &nofile);
+  }
+
+  // Children exiting wake up commando while jobs are waiting to start
+  if(pipe2(sigchld_pipe, O_CLOEXEC | O_NONBLOCK) == -1){
+    perror("Failed to create pipe");
+    exit(1);
+  }
+  struct sigaction sa = { .sa_handler = sigchld_handler, .sa_flags = SA_RESTART }; // stops and continues wake up too
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGCHLD, &sa, NULL);
+
+  cmdcol_t *new_cmdcol = calloc(1, sizeof(cmdcol_t)); // There is only one of this!! All fields start 0/NULL
+  new_cmdcol->wake_fd = sigchld_pipe[PREAD];
+
+  // Echo (print) given input if echoing is enabled. Three total cases
+  /*
+  |````````|````````|
+  | unset  | export |
+  | --echo | --echo |
+  | enable | enable |
+  |````````|````````|
+  | unset  | export |
+  |  NULL  |  NULL  |
+  | disable| enable |
+  ```````````````````
+  The only time when echo should not print is when COMMANDO_ECHO is unset and there is no --echo argument.
+  */
+  int echo_on = 0;
+  char *trace_file = NULL;
+  int adopt_fd = -1;
+  if(argc == 1 || (argc == 3 && strcmp(argv[1], "--adopt") == 0)){ // just ./commando, perhaps restarted by reexec
+    // if echo is set via export AND argv[0] matches ./commando
+    echo_on = (echo != NULL && strncmp(argv[0], "./commando", strlen("./commando")) == 0);
+  }
+  for(int i = 1; i < argc; i++){ // options such as ./commando --echo --max-jobs 4
+    if(strncmp(argv[i], echo_str, strlen(echo_str)) == 0){
+      echo_on = 1;
+    }
+    else if(strcmp(argv[i], "--max-jobs") == 0 && i+1 < argc){
+      new_cmdcol->max_running = atoi(argv[++i]);
+    }
+    else if(strcmp(argv[i], "--output-budget") == 0 && i+1 < argc){
+      new_cmdcol->output_budget = parse_size(argv[++i]); // such as 64M or 2G
+      if(new_cmdcol->output_budget == -1){
+        printf("commando: bad output budget '%s', use a size like 512M or 2G\n", argv[i]);
+        exit(1);
+      }
+    }
+    else if(strcmp(argv[i], "--capture") == 0 && i+1 < argc){
+      new_cmdcol->capture = (strcmp(argv[++i], "memfd") == 0) ? CAPTURE_MEMFD : CAPTURE_PIPE;
+    }
+    else if(strcmp(argv[i], "--trace") == 0 && i+1 < argc){
+      trace_file = argv[++i]; // written when commando exits
+    }
+    else if(strcmp(argv[i], "--adopt") == 0 && i+1 < argc){
+      adopt_fd = atoi(argv[++i]); // jobs handed over by reexec
+    }
+  }
+  if(adopt_fd != -1){
+    cmdcol_adopt(new_cmdcol, adopt_fd);
+    write(sigchld_pipe[PWRITE], "c", 1); // children which exited during the exec have sent no SIGCHLD here
+  }
 
   while(1){
     printf("@> "); // print the @> prompt
+    fflush(stdout); // everything up to the prompt is shown before waiting for input
+
+    // While jobs are waiting to start, keep starting them as others finish until a line of input arrives
+    wait_for_input(new_cmdcol);
 
     // need to ensure buffer isn't overflowed
     if(sizeof(buffer) <= MAX_LINE){
-      input = fgets(buffer, MAX_LINE, stdin); // get input string in C programming
+      input = read_line(buffer, MAX_LINE); // get input string, like fgets() on stdin
     }
     // if no input remains, print End of input and break out of loop
     if(input == NULL){
-      printf("\nEnd of input");
+      end_of_input = 1;
       break;
     }
 
-    // Echo (print) given input if echoing is enabled. Three total cases
-    /*
-    |````````|````````|
-    | unset  | export |
-    | --echo | --echo |
-    | enable | enable |
-    |````````|````````|
-    | unset  | export |
-    |  NULL  |  NULL  |
-    | disable| enable |
-    ```````````````````
-    The only time when echo should not print is when COMMANDO_ECHO is unset and there is no argv[1] argument.
-    */
-    if(argv[0] && !argv[1]){ // just ./commando
-      // if echo is set via export AND argv[0] matches ./commando
-      if(echo != NULL && strncmp(argv[0], "./commando", strlen("./commando")) == 0){
-        int i = 0;
-        while(input[i] != '\0'){
-          printf("%c", input[i]);
-          i++;
-        }
-      }
-    }
-    if(argv[0] && argv[1]){ // ./commando --echo
-      // if echo is unset AND argv[1] matches --echo
-      if(echo == NULL && strncmp(argv[1], echo_str, strlen(echo_str)) == 0){
-        int i = 0;
-        while(input[i] != '\0'){
-          printf("%c", input[i]);
-          i++;
-        }
-      }
-      // if echo is set AND argv[1] matches --echo
-      if(echo != NULL && strncmp(argv[1], echo_str, strlen(echo_str)) == 0){
-        int i = 0;
-        while(input[i] != '\0'){
-          printf("%c", input[i]);
-          i++;
-        }
-      }
+    if(echo_on){
+      fputs(input, stdout); // the whole line at once, buffered with the rest
     }
 
     // Parse input using parse_into_tokens from util.c to produce argv[]. It is for sure null terminated. See util.c
@@ -100,20 +246,57 @@ int main(int argc, char *argv[]){
       // help cmd
       if(strncmp(tokens[0], commands[0], strlen(commands[0])) == 0){ // if the 0th token is help; strncmp returns 0 if identical
         printf("COMMANDO COMMANDS\n");
-        printf("help              : show this message\n");
-        printf("exit              : exit the program\n");
-        printf("list              : list all jobs that have been started giving information on each\n");
-        printf("pause nanos secs  : pause for the given number of nanseconds and seconds\n");
-        printf("output-for int    : print the output for given job number\n");
-        printf("output-all        : print output for all jobs\n");
-        printf("wait-for int      : wait until the given job number finishes\n");
-        printf("wait-all          : wait for all jobs to finish\n");
-        printf("command arg1 ...  : non-built-in is run as a job\n");
-      }
-
-      // exit cmd
+        printf("help               : show this message\n");
+        printf("exit               : exit the program, jobs still running get TERM then KILL %dms later\n", SHUTDOWN_KILL_MS);
+        printf("exit --wait        : exit once all jobs finish; --term-after MS waits MS first, --kill kills at once\n");
+        printf("list               : list all jobs that have been started giving information on each\n");
+        printf("pause nanos secs   : pause for the given number of nanseconds and seconds\n");
+        printf("output-for int     : print the output for given job number\n");
+        printf("output-for int > f : write the output for given job number to file f\n");
+        printf("output-for int ... : with --timestamps show when each line arrived, --gaps MS marks stalls\n");
+        printf("output-all         : print output for all jobs\n");
+        printf("save int file      : save only the output of given job number to file\n");
+        printf("wait-for int       : wait until the given job number finishes\n");
+        printf("wait-all           : wait for all jobs to finish\n");
+        printf("output-for gN      : print outputs of group N in order as each becomes available\n");
+        printf("map cmd {} ::: a b : run cmd once per argument with {} replaced, as group gN\n");
+        printf("max-jobs int       : limit how many jobs run at once, 0 for no limit\n");
+        printf("after int,int cmd  : run cmd as a job once the given jobs finish\n");
+        printf("after-ok int cmd   : like after but only runs if the given jobs EXIT(0)\n");
+        printf("stats              : show latency percentiles for each phase of the life of jobs\n");
+        printf("trace-dump file    : write a Chrome trace-event timeline of all jobs to file\n");
+        printf("kill int [sig]     : send a signal to a job, TERM by default, such as kill 2 KILL\n");
+        printf("stop int           : stop a job until it is continued\n");
+        printf("cont int           : continue a stopped job\n");
+        printf("capture pipe|memfd : how new jobs capture output, memfd skips the pipe for batch jobs\n");
+        printf("hash [-r]          : list where commands were found in PATH, -r to forget them\n");
+        printf("on-output int p act: when p shows up in the output of a job, act: alert, kill, or run cmd ...\n");
+        printf("feed int cmd ...   : run cmd as a job with the output of given job number as its input\n");
+        printf("run [--pty] cmd ...: run cmd as a job, with --pty its output goes to a pseudo-terminal\n");
+        printf("bench N cmd ...    : time N runs of cmd, not as jobs; --warmup K after N runs it K times first\n");
+        printf("reexec [path]      : restart as the commando at path, by default this one, keeping all jobs\n");
+        printf("command arg1 ...   : non-built-in is run as a job\n");
+        printf("command ... < file : run as a job reading input from file\n");
+      }
+
+      // exit [--wait | --term-after MS | --kill]
       else if(strncmp(tokens[0], commands[1], strlen(commands[1])) == 0){
-        break;
+        if(tokens[1] == NULL){
+          break; // TERM now, as at the end of input
+        }
+        else if(strcmp(tokens[1], "--wait") == 0){
+          term_after = -1;
+          break;
+        }
+        else if(strcmp(tokens[1], "--term-after") == 0 && tokens[2] != NULL && atoi(tokens[2]) >= 0){
+          term_after = atoi(tokens[2]);
+          break;
+        }
+        else if(strcmp(tokens[1], "--kill") == 0){
+          kill_after = 0;
+          break;
+        }
+        printf("usage: exit [--wait | --term-after MS | --kill]\n");
       }
 
       // list cmd
@@ -138,39 +321,88 @@ int main(int argc, char *argv[]){
           nano = atoi(tokens[1]);
           secs = atoi(tokens[2]);
         }
+        fflush(stdout); // show output so far before sleeping
         pause_for(nano, secs);
       }
 
-      // output-for int cmd
+      // output-for int cmd, optionally > file
       else if(strncmp(tokens[0], commands[4], strlen(commands[4])) == 0){
-        int job_num = atoi(tokens[1]); // this is the job number
-        // print this job
-        printf("@<<< Output for %s[#%d] (%d bytes):\n", new_cmdcol->cmd[job_num]->name, new_cmdcol->cmd[job_num]->pid, new_cmdcol->cmd[job_num]->output_size);
-        printf("----------------------------------------\n");
-        //cmd_fetch_output(new_cmdcol->cmd[job_num]); // Do I need this?
-        cmd_print_output(new_cmdcol->cmd[job_num]);
-        printf("----------------------------------------\n");
+        cmdgroup_t *group = cmdcol_get_group(new_cmdcol, tokens[1]);
+        if(group != NULL){ // output-for gN
+          print_group_output(new_cmdcol, group, tokens[1]);
+          cmdcol_update_state(new_cmdcol, NOBLOCK);
+          continue;
+        }
+        cmd_t *cmd = cmdcol_get(new_cmdcol, tokens[1]); // this is the job
+        if(cmd != NULL && tokens[2] != NULL && strcmp(tokens[2], ">") == 0){
+          save_output(cmd, tokens[3], 1);
+        }
+        else if(cmd != NULL && tokens[2] != NULL){ // --timestamps and/or --gaps MS
+          int timestamps = 0, bad = 0;
+          long long gap_nanos = 0;
+          for(int t = 2; tokens[t] != NULL && !bad; t++){
+            if(strcmp(tokens[t], "--timestamps") == 0){
+              timestamps = 1;
+            }
+            else if(strcmp(tokens[t], "--gaps") == 0 && tokens[t+1] != NULL && atoi(tokens[t+1]) > 0){
+              gap_nanos = atoi(tokens[++t]) * 1000000LL;
+            }
+            else{
+              bad = 1;
+            }
+          }
+          if(bad){
+            printf("usage: output-for int [--timestamps] [--gaps MS]\n");
+          }
+          else if(cmdcol_use_output(new_cmdcol, cmd) == 0){
+            cmd_print_timed_output(cmd, timestamps, gap_nanos);
+          }
+          else{
+            printf("%s[#%d] : output not ready\n", cmd->name, cmd->pid);
+          }
+        }
+        else if(cmd != NULL && cmdcol_use_output(new_cmdcol, cmd) == 0){
+          cmd_write_output(cmd, STDOUT_FILENO, 1); // header and output in one writev()
+        }
+        else if(cmd != NULL){
+          printf("@<<< Output for %s[#%d] (%d bytes):\n", cmd->name, cmd->pid, cmd->output_size);
+          printf(DIVIDER);
+          cmd_print_output(cmd); // reports output not ready
+          printf(DIVIDER);
+        }
       }
 
       // output-all cmd
       else if(strncmp(tokens[0], commands[5], strlen(commands[5])) == 0){
         // loop through and print all output
         for (int i = 0; i < new_cmdcol->size; i++){
-          printf("@<<< Output for %s[#%d] (%d bytes):\n", new_cmdcol->cmd[i]->name, new_cmdcol->cmd[i]->pid, new_cmdcol->cmd[i]->output_size);
-          printf("----------------------------------------\n");
-          //cmd_fetch_output(new_cmdcol->cmd[job_num]); // Do I need this?
-          cmd_print_output(new_cmdcol->cmd[i]);
-          printf("----------------------------------------\n");
+          cmd_t *cmd = new_cmdcol->cmd[i];
+          if(cmdcol_use_output(new_cmdcol, cmd) == 0){
+            cmd_write_output(cmd, STDOUT_FILENO, 1);
+            continue;
+          }
+          printf("@<<< Output for %s[#%d] (%d bytes):\n", cmd->name, cmd->pid, cmd->output_size);
+          printf(DIVIDER);
+          cmd_print_output(cmd);
+          printf(DIVIDER);
+        }
+      }
+
+      // save int file
+      else if(strcmp(tokens[0], commands[9]) == 0){
+        cmd_t *cmd = cmdcol_get(new_cmdcol, tokens[1]);
+        if(cmd != NULL){
+          save_output(cmd, tokens[2], 0);
         }
       }
 
       // wait-for int cmd
       else if(strncmp(tokens[0], commands[6], strlen(commands[6])) == 0){
-        int wait = atoi(tokens[1]);
+        cmd_t *cmd = cmdcol_get(new_cmdcol, tokens[1]); // check to make sure this job actually exists
 
-        // The wait-for int command translates to a call to cmd_update_state() with the DOBLOCK option.
-        if(new_cmdcol->size != 0 && new_cmdcol->cmd[wait]){ // check to make sure this job actually exists
-          cmd_update_state(new_cmdcol->cmd[wait], DOBLOCK);
+        // The wait-for int command blocks until the job finishes, starting queued jobs along the way
+        if(cmd != NULL){
+          cmdcol_wait_for(new_cmdcol, cmd);
         }
       }
 
@@ -179,15 +411,224 @@ int main(int argc, char *argv[]){
 
         // wait for all commands
         for(int i = 0; i < new_cmdcol->size; i++){
-          cmd_update_state(new_cmdcol->cmd[i], DOBLOCK);
+          cmdcol_wait_for(new_cmdcol, new_cmdcol->cmd[i]);
+        }
+      }
+
+      // feed int cmd ...
+      else if(strcmp(tokens[0], commands[8]) == 0){
+        cmd_t *cmd = (tokens[1] != NULL && tokens[2] != NULL) ? cmdcol_get(new_cmdcol, tokens[1]) : NULL;
+        if(tokens[1] == NULL || tokens[2] == NULL){
+          printf("usage: feed int cmd arg1 ...\n");
+        }
+        else if(cmd == NULL){
+          // cmdcol_get() said why
+        }
+        else if(cmdcol_use_output(new_cmdcol, cmd) == -1){
+          cmd_print_output(cmd); // reports output not ready
+        }
+        else{
+          // the new job reads the stored output directly, output kept in
+          // segments is joined once so there is a single buffer to read
+          char *input = cmd_join_output(cmd);
+          if(input == NULL){
+            printf("feed: no memory to join the output of job %d\n", cmd->job);
+          }
+          else{
+            cmd_t *new_cmd = cmd_new(tokens+2);
+            cmd_set_input(new_cmd, input, cmd->output_size);
+            add_job(new_cmdcol, new_cmd);
+            cmdcol_schedule(new_cmdcol);
+          }
+        }
+      }
+
+      // map cmd arg {} ::: a b c
+      else if(strcmp(tokens[0], commands[10]) == 0){
+        int first = new_cmdcol->size;
+        int group = cmdcol_map(new_cmdcol, tokens+1);
+        if(group == -1){
+          printf("usage: map cmd arg1 {} ... ::: a b c\n");
+        }
+        else{
+          printf("Group g%d is jobs %d to %d\n", group, first, new_cmdcol->size-1);
+        }
+      }
+
+      // max-jobs int
+      else if(strcmp(tokens[0], commands[11]) == 0){
+        if(tokens[1] != NULL){
+          new_cmdcol->max_running = atoi(tokens[1]);
+          cmdcol_schedule(new_cmdcol); // a higher limit may let queued jobs start
+        }
+        printf("max-jobs: %d\n", new_cmdcol->max_running);
+      }
+
+      // after-ok int,int cmd ... and after int,int cmd ...
+      else if(strcmp(tokens[0], commands[12]) == 0 ||
+              strcmp(tokens[0], commands[13]) == 0){
+        int after_ok = (strcmp(tokens[0], commands[12]) == 0);
+        if(tokens[1] == NULL){
+          printf("usage: after int,int,... cmd arg1 ...\n");
+        }
+        else{
+          cmdcol_after(new_cmdcol, tokens[1], tokens+2, after_ok);
+        }
+      }
+
+      // stats
+      else if(strcmp(tokens[0], commands[14]) == 0){
+        cmdcol_print_stats(new_cmdcol);
+      }
+
+      // trace-dump file
+      else if(strcmp(tokens[0], commands[15]) == 0){
+        if(tokens[1] == NULL){
+          printf("usage: trace-dump file.json\n");
+        }
+        else{
+          cmdcol_write_trace(new_cmdcol, tokens[1]);
+        }
+      }
+
+      // kill int [sig]
+      else if(strcmp(tokens[0], commands[16]) == 0){
+        int sig = (tokens[1] != NULL && tokens[2] != NULL) ? parse_signal(tokens[2]) : SIGTERM;
+        if(tokens[1] == NULL || sig == -1){
+          printf("usage: kill int [sig]\n");
+        }
+        else{
+          cmdcol_signal(new_cmdcol, tokens[1], sig);
+        }
+      }
+
+      // stop int
+      else if(strcmp(tokens[0], commands[17]) == 0){
+        cmdcol_signal(new_cmdcol, tokens[1], SIGSTOP);
+      }
+
+      // cont int
+      else if(strcmp(tokens[0], commands[18]) == 0){
+        cmdcol_signal(new_cmdcol, tokens[1], SIGCONT);
+      }
+
+      // capture pipe|memfd
+      else if(strcmp(tokens[0], commands[19]) == 0){
+        if(tokens[1] != NULL && strcmp(tokens[1], "pipe") == 0){
+          new_cmdcol->capture = CAPTURE_PIPE;
+        }
+        else if(tokens[1] != NULL && strcmp(tokens[1], "memfd") == 0){
+          new_cmdcol->capture = CAPTURE_MEMFD;
+        }
+        else if(tokens[1] != NULL){
+          printf("usage: capture pipe|memfd\n");
+        }
+        printf("capture: %s\n", (new_cmdcol->capture == CAPTURE_MEMFD) ? "memfd" : "pipe");
+      }
+
+      // hash [-r]
+      else if(strcmp(tokens[0], commands[20]) == 0){
+        if(tokens[1] != NULL && strcmp(tokens[1], "-r") == 0){
+          path_cache_clear();
+        }
+        else{
+          path_cache_print();
+        }
+      }
+
+      // on-output int pattern alert|kill|run cmd ...
+      else if(strcmp(tokens[0], commands[21]) == 0){
+        int action = -1;
+        if(tokens[1] != NULL && tokens[2] != NULL && tokens[3] != NULL){
+          action = (strcmp(tokens[3], "alert") == 0) ? TRIGGER_ALERT :
+                   (strcmp(tokens[3], "kill") == 0)  ? TRIGGER_KILL :
+                   (strcmp(tokens[3], "run") == 0 && tokens[4] != NULL) ? TRIGGER_RUN : -1;
+        }
+        cmd_t *cmd = (action != -1) ? cmdcol_get(new_cmdcol, tokens[1]) : NULL;
+        if(action == -1){
+          printf("usage: on-output int pattern alert|kill|run cmd ...\n");
+        }
+        else if(cmd == NULL){
+          // cmdcol_get() said why
+        }
+        else if(cmd->finished){
+          printf("%s[#%d] has already finished\n", cmd->name, cmd->pid);
+        }
+        else if(cmd->capture == CAPTURE_MEMFD){
+          printf("%s[#%d] captures with memfd, on-output needs capture pipe\n", cmd->name, cmd->pid);
+        }
+        else if(cmd_add_trigger(cmd, tokens[2], action, &tokens[4]) == -1){
+          printf("%s[#%d] already has %d on-output triggers\n", cmd->name, cmd->pid, MAX_TRIGGERS);
+        }
+      }
+
+      // run [--pty] cmd argl
+      else if(strcmp(tokens[0], commands[22]) == 0){
+        int first = 1;
+        int capture = -1; // capture mode of the session unless given
+        if(tokens[1] != NULL && strcmp(tokens[1], "--pty") == 0){
+          capture = CAPTURE_PTY; // line buffered output from stdio in the child
+          first = 2;
+        }
+        int nargs = ntoks - first;
+        char *input_file = parse_stdin_redirect(tokens + first, &nargs);
+        if(nargs <= 0){
+          printf("usage: run [--pty] cmd arg1 ... < file\n");
+        }
+        else{
+          cmd_t *new_cmd = cmd_new(tokens + first);
+          cmd_set_stdin(new_cmd, input_file);
+          if(add_job(new_cmdcol, new_cmd) != -1 && capture != -1){
+            new_cmd->capture = capture;
+          }
+          cmdcol_schedule(new_cmdcol);
+        }
+      }
+
+      // bench N [--warmup K] cmd argl
+      else if(strcmp(tokens[0], commands[23]) == 0){
+        char *end = NULL;
+        long nruns = (tokens[1] != NULL) ? strtol(tokens[1], &end, 10) : 0;
+        long nwarmup = 0;
+        int first = 2;
+        if(end != NULL && *end == '\0' && tokens[2] != NULL && strcmp(tokens[2], "--warmup") == 0){
+          nwarmup = (tokens[3] != NULL) ? strtol(tokens[3], &end, 10) : -1;
+          first = 4;
+        }
+        if(end == NULL || *end != '\0' || nruns < 1 || nruns > MAX_BENCH_RUNS || nwarmup < 0 || nwarmup > MAX_BENCH_RUNS ||
+           first >= ntoks){
+          printf("usage: bench N [--warmup K] cmd arg1 ...\n");
+        }
+        else{
+          cmdcol_bench(new_cmdcol, nruns, nwarmup, tokens + first);
+        }
+      }
+
+      // reexec [path]
+      else if(strcmp(tokens[0], commands[24]) == 0){
+        // by default the file commando was started from, where a rebuild puts the new binary
+        char *path = (tokens[1] != NULL) ? tokens[1] :
+                     (strchr(argv[0], '/') != NULL) ? argv[0] : path_lookup(argv[0]);
+        if(path == NULL){
+          printf("reexec: cannot find %s, give its path\n", argv[0]);
+        }
+        else{
+          cmdcol_reexec(new_cmdcol, path, argv);
         }
       }
 
       // command argl
       else{
+        char *input_file = parse_stdin_redirect(tokens, &ntoks); // cmd < file
+        if(ntoks == 0){
+          printf("usage: command arg1 ... < file\n");
+          cmdcol_update_state(new_cmdcol, NOBLOCK);
+          continue;
+        }
         // 0th token do not match above cmds. Create a new cmd_t instance where the tokens are the argv[] for it and start running it.
         //cmd_t *cmd_argl = malloc(sizeof(cmd_t);
         cmd_t *new_cmd = cmd_new(tokens);
+        cmd_set_stdin(new_cmd, input_file); // NULL keeps /dev/null
         //new_cmd = cmd_new(tokens); THIS SON OF A GUN CAUSED ME SO MUCH HEADACHE
         //Debugging
         /*
@@ -214,7 +655,7 @@ int main(int argc, char *argv[]){
         printf("int output_size; is: %-10d\n", new_cmd->output_size);
         printf("\n");
         */
-        cmdcol_add(new_cmdcol, new_cmd); // add this to cmdcol_t
+        add_job(new_cmdcol, new_cmd); // add this to cmdcol_t
 
         /* Debugging cmdcol_add
         printf("Printing all cmds in cmdcol_t struct\n");
@@ -236,17 +677,28 @@ int main(int argc, char *argv[]){
         printf("\n");
 
         */
-        cmd_start(new_cmd); // start running
+        cmdcol_schedule(new_cmdcol); // start running unless too many jobs already are
         //printf("2. Child PID is %d: \n", new_cmd->pid);
 
       }
     }
     // At the end of each iteration of the main loop of commando, each job should be checked for updates to its status. cmdcol_update_state() is a good idea to update everything. This call should not block.
     cmdcol_update_state(new_cmdcol, NOBLOCK);
+    cmdcol_schedule(new_cmdcol); // fill any slots freed by finished jobs
 
   }
+  // End jobs still running rather than orphan them, reaping them so
+  // their status is recorded; alerts go before End of input
+  cmdcol_shutdown(new_cmdcol, term_after, kill_after);
+  if(end_of_input){
+    printf("\nEnd of input");
+  }
+
   // free all dynamically allocated memory/ptrs
 
+  if(trace_file != NULL){
+    cmdcol_write_trace(new_cmdcol, trace_file);
+  }
   cmdcol_freeall(new_cmdcol); // Will this do the trick?
   free(new_cmdcol);
 
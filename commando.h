@@ -1,3 +1,4 @@
+#define _GNU_SOURCE   // for vmsplice() and other Linux-specific calls
 #include <stdio.h>
 #include <stdlib.h> // provides functions for maniputing environment variables
 #include <unistd.h>
@@ -8,6 +9,29 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <stddef.h>
+#include <sys/uio.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <pwd.h>
+#include <termios.h>
+#include <math.h>
+
+// Static probes for perf and bpftrace, built in with 'make USDT=1'.
+// Each probe is a nop instruction plus a note in the binary until a
+// tracer attaches; without USDT they compile to nothing and their
+// arguments are not evaluated. commando.bt lists the probes.
+#ifdef COMMANDO_USDT
+#include <sys/sdt.h>
+#define PROBE(name, ...) STAP_PROBEV(commando, name, __VA_ARGS__)
+#else
+#define PROBE(name, ...) do{ } while(0)
+#endif
 
 // Compile time constants.
 #define BUFSIZE 1024   // size of read/write buffers
@@ -16,8 +40,24 @@
 #define NAME_MAX 255   // max len of commands and args
 #define ARG_MAX 255    // max number of arguments
 #define MAX_LINE 1024  // maximum length of input lines
-#define MAX_CMDS 1024  // maximum number of child commands in commando
-#define STATUS_LEN 10  // length of the str_status field in childcmd
+#define MAX_CMDS 1024  // initial capacity of the cmd array in a cmdcol, grows as needed
+#define STATUS_LEN 15  // length of the str_status field in childcmd
+#define OUTBUF_SIZE 65536 // size of the stdout buffer, flushed at each prompt
+#define MAX_OUTPUT 0x7ffffffe // largest output_size, one less than INT_MAX leaves room for the null
+#define CAPTURE_PIPE 0  // output read through a pipe while the job runs
+#define CAPTURE_MEMFD 1 // output written to a memfd and mapped once the job exits
+#define CAPTURE_PTY 2   // output read from a pseudo-terminal so the child line buffers it
+#define DIVIDER "----------------------------------------\n" // surrounds output-for text
+#define CHUNK_MERGE_NS 1000000 // reads of output closer together than this share one chunk
+#define SEGMENT_SIZE 16384 // bytes of output held by one segment of a chain
+#define SEGMENT_POOL_MAX 64 // free segments kept for reuse by later jobs
+#define SEGMENT_IOV 64     // segments handed to each writev() call
+#define MAX_BENCH_RUNS 1000000 // most runs, and warmup runs, bench will make
+#define SHUTDOWN_KILL_MS 1000 // at exit, how long jobs sent SIGTERM have before SIGKILL
+#define MAX_TRIGGERS 64 // on-output triggers per job, one bit each in a 64-bit mask
+#define TRIGGER_ALERT 0 // on-output actions: print an alert
+#define TRIGGER_KILL 1  //   send the job SIGTERM
+#define TRIGGER_RUN 2   //   start another command as a new job
 
 // block options to update_cmd_status() indicating whether to block or
 // not on waiting for child; passed to wait()
@@ -26,42 +66,223 @@
 
 #define eprintf(...) fprintf (stderr, __VA_ARGS__)
 
+// cmdtimes_t: CLOCK_MONOTONIC nanosecond timestamps of points in the
+// life of a job, 0 if the point has not been reached
+typedef struct {
+  long long created;       // cmd_new() called
+  long long fork;          // just before fork() in cmd_start()
+  long long forked;        // fork() returned in the parent
+  long long exec;          // child about to call execvp()
+  long long first_output;  // first byte of output drained
+  long long output_eof;    // output pipe closed, usually on exit
+  long long reaped;        // exit status collected by waitpid()
+  long long captured;      // output handed to the output field
+} cmdtimes_t;
+
+// outchunk_t: marks where output read at one time starts; the chunk
+// runs up to the offset of the next one or the end of the output
+typedef struct {
+  long long at;            // CLOCK_MONOTONIC time the first read of the chunk returned
+  int offset;              // position of the first byte of the chunk in output
+} outchunk_t;
+
+// outseg_t: one piece of the output of a job, chained in the order read
+typedef struct outseg {
+  struct outseg *next;     // next segment of the chain, NULL for the last
+  int len;                 // bytes of data in use, SEGMENT_SIZE once full
+  char data[SEGMENT_SIZE];
+} outseg_t;
+
+// trigger_t: an on-output pattern and what to do the first time it is seen
+typedef struct {
+  char  *pattern;          // bytes to look for in the output
+  int    action;           // TRIGGER_ALERT, TRIGGER_KILL or TRIGGER_RUN
+  char **argv;             // command to run for TRIGGER_RUN, NULL otherwise
+} trigger_t;
+
+// matcher_t: Aho-Corasick automaton over the patterns of the triggers of a job
+typedef struct {
+  trigger_t triggers[MAX_TRIGGERS];
+  int ntriggers;           // number of triggers in use
+  unsigned long long fired; // bit i set once triggers[i] has fired
+  int (*next)[256];        // next[s][c] is the state after byte c in state s
+  unsigned long long *hits; // bit i set in hits[s] if the pattern of triggers[i] ends at state s
+  int nstates;             // number of states in next and hits
+  int state;               // current state, carried from one read to the next
+} matcher_t;
+
 // cmd_t: struct to represent a running command/child process.
 typedef struct {
-  char   name[NAME_MAX+1]; // name of command like "ls" or "gcc"
-  char  *argv[ARG_MAX+1];  // argv for running child, NULL terminated
+  char  *name;             // name of command like "ls" or "gcc", same string as argv[0]
+  int    job;              // job number in its cmdcol, -1 until cmdcol_add()
+  char **argv;             // argv for running child, NULL terminated, at most ARG_MAX args
   pid_t  pid;              // PID of child
   int    out_pipe[2];      // pipe for child output
-  int    finished;
-   // 1 if child process finished, 0 otherwise
+  int    finished;         // 1 if child process finished, 0 otherwise
+  int    stopped;          // 1 while the child is stopped by a signal
   int    status;           // return value of child, -1 if not finished
   char   str_status[STATUS_LEN+1]; // describes child status such as RUN or EXIT(..)
-  void  *output;           // saved output from child, NULL initially
+  void  *output;           // saved output from child in one buffer, NULL initially or if kept in segs
   int    output_size;      // number of bytes in output
+  char  *input_file;       // file to use as stdin for child, NULL for /dev/null
+  void  *input;            // buffer fed to stdin of child such as another job's output, not owned
+  int    input_size;       // number of bytes in input
+  int   *after;            // job numbers which must finish before starting, NULL if none
+  int    nafter;           // number of job numbers in after
+  int    after_ok;         // 1 if the jobs in after must also EXIT(0)
+  outseg_t *segs;          // output read from out_pipe, kept as the output of a finished child unless joined into output
+  outseg_t *segs_tail;     // last segment of segs, where reads go
+  int    drained_size;     // number of bytes in segs
+  long long cut_size;      // bytes read past MAX_OUTPUT and dropped
+  outchunk_t *chunks;      // arrival time of each chunk of segs/output, NULL if none
+  int    nchunks;          // number of chunks
+  int    chunks_max;       // allocated length of chunks
+  int    output_eof;       // 1 once out_pipe has reached end of file
+  int    exec_pipe;        // read end of close-on-exec pipe reporting the exec, -1 when done
+  int    exec_errno;       // errno of a failed exec in the child, 0 if it ran
+  cmdtimes_t times;        // when each point in the life of the job was reached
+  char  *spill_file;       // file holding a copy of output once evicted, NULL if never evicted
+  long long last_used;     // when output was captured or last viewed, orders eviction
+  int    capture;          // CAPTURE_PIPE, CAPTURE_MEMFD or CAPTURE_PTY
+  int    capture_fd;       // memfd the child writes its output to, -1 if not used
+  int    output_mapped;    // 1 if output is an mmap() of the capture file rather than malloc()'d
+  matcher_t *matcher;      // on-output triggers watching the output, NULL if none
 } cmd_t;
 
+// benchrun_t: measurements of one timed run made by bench
+typedef struct {
+  long long wall;          // nanoseconds from just before fork() until reaped
+  long long user;          // user CPU time in nanoseconds, from wait4()
+  long long sys;           // system CPU time in nanoseconds
+  long long maxrss;        // peak resident memory in KB
+  unsigned long long hash; // FNV-1a hash of the output
+  long long nbytes;        // bytes of output
+  int wstatus;             // status from wait4()
+} benchrun_t;
+
+// cmdgroup_t: a job array of consecutive jobs such as those created by map
+typedef struct {
+  int first;               // job number of the first member
+  int count;               // number of members
+} cmdgroup_t;
+
+// cmdrow_t: copy of the fields of a cmd which the sweeps and list
+// read, kept in an array parallel to cmdcol_t.cmd so scanning them
+// does not touch a cmd_t per job. Refreshed from the cmd by
+// cmdcol_sync(); a job's row stops changing once it finishes.
+typedef struct {
+  pid_t pid;               // as in cmd_t
+  int   status;
+  int   output_size;
+  char  finished;
+  char  str_status[STATUS_LEN+1];
+} cmdrow_t;
+
 // cmdcol_t: struct for tracking multiple commands
 typedef struct {
-  cmd_t *cmd[MAX_CMDS];    // array of pointers to struct cmd_t
+  cmd_t **cmd;             // array of pointers to struct cmd_t, NULL initially
+  cmdrow_t *rows;          // hot fields of each cmd, same length as cmd
   int size;                // number of cmds in the array
+  int capacity;            // allocated length of cmd
+  int *live;               // job numbers of cmds not known to be finished, ascending
+  int nlive;               // number of entries in live
+  int max_running;         // limit on jobs running at once, 0 for no limit
+  cmdgroup_t *groups;      // job arrays, NULL initially
+  int ngroups;             // number of groups
+  int wake_fd;             // readable when a child exits (SIGCHLD self-pipe), 0 if not set up
+  long long output_budget; // limit on bytes of output kept in memory, 0 for no limit
+  int capture;             // capture mode given to jobs as they are added
 } cmdcol_t;
 
+// bench.c
+void bench_report(benchrun_t runs[], int nruns);
+int cmdcol_bench(cmdcol_t *col, int nruns, int nwarmup, char *argv[]);
+
+// glob.c
+int glob_token(char *tok, char *out[], int max);
+void glob_release(void);
+
+// pathcache.c
+char *path_lookup(char *name);
+void path_cache_clear(void);
+void path_cache_print(void);
+
+// reexec.c
+int cmdcol_reexec(cmdcol_t *col, char *path, char *argv[]);
+int cmdcol_adopt(cmdcol_t *col, int fd);
+
+// trigger.c
+int cmd_add_trigger(cmd_t *cmd, char *pattern, int action, char *argv[]);
+void cmd_scan_output(cmd_t *cmd, char *buf, int len);
+int cmd_watching(cmd_t *cmd);
+void matcher_free(matcher_t *m);
+int cmdcol_run_triggers(cmdcol_t *col);
+
+// segment.c
+outseg_t *segment_get(void);
+void segment_release(outseg_t *segs);
+char *segment_join(outseg_t *segs, int size);
+
+// stats.c
+void cmdcol_print_stats(cmdcol_t *col);
+
+// trace.c
+int cmdcol_write_trace(cmdcol_t *col, char *path);
+
 // util.c
 void parse_into_tokens(char input_command[], char *tokens[], int *ntok);
+char *parse_stdin_redirect(char *tokens[], int *ntok);
+char *read_line(char *buf, int size);
+int line_ready(void);
+int input_save(char *buf);
+void input_restore(char *buf, int len);
+long long parse_size(char *str);
+int parse_signal(char *str);
 void pause_for(long nanos, int secs);
 
 // cmd.c
 cmd_t *cmd_new(char *argv[]);
 void cmd_free(cmd_t *cmd);
-void cmd_set_stdin(cmd_t *cmd, char *input_file); // ignore
-void cmd_start(cmd_t *cmd);
+void cmd_set_stdin(cmd_t *cmd, char *input_file);
+void cmd_set_input(cmd_t *cmd, void *input, int input_size);
+void cmd_set_after(cmd_t *cmd, int after[], int nafter, int after_ok);
+int cmd_start(cmd_t *cmd);
 void cmd_fetch_output(cmd_t *cmd);
 void cmd_print_output(cmd_t *cmd);
+int cmd_output_in_memory(cmd_t *cmd);
+char *cmd_join_output(cmd_t *cmd);
+void cmd_discard_output(cmd_t *cmd);
 void cmd_update_state(cmd_t *cmd, int nohang);
 char *read_all(int fd, int *nread);
+int cmd_drain(cmd_t *cmd, int block);
+void cmd_read_exec_pipe(cmd_t *cmd);
+void cmd_set_embedded(int on);
+void cmd_alert(cmd_t *cmd, char *what);
+long long now_nanos(void);
+int write_all(int fd, struct iovec *iov, int iovcnt);
+int cmd_output_header(cmd_t *cmd, char *buf, int bufsize);
+int cmd_write_output(cmd_t *cmd, int fd, int with_header);
+int cmd_save_output(cmd_t *cmd, int fd, int with_header);
+void cmd_print_timed_output(cmd_t *cmd, int timestamps, long long gap_nanos);
+int cmd_spill_output(cmd_t *cmd);
+int cmd_load_output(cmd_t *cmd);
 
 // cmdcol.c
-void cmdcol_add(cmdcol_t *col, cmd_t *cmd);
+int cmdcol_add(cmdcol_t *col, cmd_t *cmd);
+cmd_t *cmdcol_get(cmdcol_t *col, char *job_str);
+int cmdcol_add_group(cmdcol_t *col, int first, int count);
+cmdgroup_t *cmdcol_get_group(cmdcol_t *col, char *group_str);
+int cmdcol_schedule(cmdcol_t *col);
+void cmdcol_wait_for(cmdcol_t *col, cmd_t *cmd);
+int cmdcol_map(cmdcol_t *col, char *tokens[]);
+int cmdcol_after(cmdcol_t *col, char *deps_str, char *argv[], int after_ok);
 void cmdcol_print(cmdcol_t *col);
-void cmdcol_update_state(cmdcol_t *col, int nohang);
+int cmdcol_update_state(cmdcol_t *col, int nohang);
+int cmdcol_poll(cmdcol_t *col, int extra_fd, int *extra_ready, int timeout);
+void cmdcol_enforce_budget(cmdcol_t *col, cmd_t *keep);
+int cmdcol_use_output(cmdcol_t *col, cmd_t *cmd);
+void cmdcol_sync(cmdcol_t *col, int job);
+int cmdcol_signal(cmdcol_t *col, char *job_str, int sig);
+int cmdcol_watching(cmdcol_t *col);
+int cmdcol_shutdown(cmdcol_t *col, int term_after, int kill_after);
 void cmdcol_freeall(cmdcol_t *col);
@@ -0,0 +1,245 @@
+// glob.c: expansion of ~ and wildcards in tokens, with a cache of directory listings
+
+#include "commando.h"
+
+// Tokens such as test-data/*.txt are expanded by commando itself so
+// that jobs do not need to be wrapped in sh -c. Wildcards *, ? and
+// [...] may appear in any component of a path and are matched with
+// fnmatch(); as in sh, a leading . must be matched explicitly and a
+// token which matches nothing is passed on as it is. The listing of
+// each directory searched is cached along with its mtime. Adding,
+// removing, or renaming an entry changes the mtime of the directory
+// so a later expansion costs one stat() rather than a reread, which
+// adds up when the same pattern is used for job after job.
+
+typedef struct {
+  char *path;              // directory as named in the pattern, "." for the current one
+  time_t sec;              // mtime of the directory when it was listed
+  long nsec;
+  char **names;            // sorted entries other than . and ..
+  int nnames;
+} dir_listing_t;
+
+static dir_listing_t **listings = NULL; // pointers so a listing stays put while others are added
+static int nlistings = 0;
+
+static char **expanded = NULL;     // strings made for the tokens of the current line
+static int nexpanded = 0;
+static int expanded_max = 0;
+
+static void free_listing(dir_listing_t *listing)
+// Frees the names in listing but not listing itself.
+{
+  for(int i = 0; i < listing->nnames; i++){
+    free(listing->names[i]);
+  }
+  free(listing->names);
+  listing->names = NULL;
+  listing->nnames = 0;
+}
+
+static void glob_cache_clear(void)
+// Forgets all directory listings and expanded strings, at exit.
+{
+  for(int i = 0; i < nlistings; i++){
+    free_listing(listings[i]);
+    free(listings[i]->path);
+    free(listings[i]);
+  }
+  free(listings);
+  listings = NULL;
+  nlistings = 0;
+  glob_release();
+}
+
+static int compare_names(const void *a, const void *b)
+// qsort() comparison of two strings so expansions come out sorted.
+{
+  return strcmp(*(char **) a, *(char **) b);
+}
+
+static dir_listing_t *list_dir(char *path)
+/* Returns the listing of the directory path, reading it only if it
+  is not cached or its mtime has changed since it was read. Returns
+  NULL if path is not a directory that can be read.
+*/
+{
+  struct stat st;
+  if(stat(path, &st) == -1 || !S_ISDIR(st.st_mode)){
+    return NULL;
+  }
+  dir_listing_t *listing = NULL;
+  for(int i = 0; i < nlistings; i++){
+    if(strcmp(listings[i]->path, path) == 0){
+      listing = listings[i];
+      break;
+    }
+  }
+  if(listing != NULL && listing->sec == st.st_mtim.tv_sec && listing->nsec == st.st_mtim.tv_nsec){
+    return listing; // unchanged since it was read
+  }
+
+  DIR *dir = opendir(path);
+  if(dir == NULL){
+    return NULL;
+  }
+  if(listing == NULL){
+    if(nlistings == 0){
+      atexit(glob_cache_clear);
+    }
+    listings = realloc(listings, (nlistings+1) * sizeof(dir_listing_t *));
+    listing = malloc(sizeof(dir_listing_t));
+    listings[nlistings++] = listing;
+    listing->path = strdup(path);
+    listing->names = NULL;
+    listing->nnames = 0;
+  }
+  free_listing(listing);
+  int max = 0;
+  struct dirent *ent;
+  while((ent = readdir(dir)) != NULL){
+    if(strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0){
+      continue;
+    }
+    if(listing->nnames == max){
+      max = (max == 0) ? 32 : 2*max;
+      listing->names = realloc(listing->names, max * sizeof(char *));
+    }
+    listing->names[listing->nnames++] = strdup(ent->d_name);
+  }
+  closedir(dir);
+  qsort(listing->names, listing->nnames, sizeof(char *), compare_names);
+  listing->sec = st.st_mtim.tv_sec;
+  listing->nsec = st.st_mtim.tv_nsec;
+  return listing;
+}
+
+static int has_wildcard(char *str, int len)
+// Returns 1 if the first len chars of str hold *, ? or [.
+{
+  for(int i = 0; i < len; i++){
+    if(str[i] == '*' || str[i] == '?' || str[i] == '['){
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int add_match(char *path, char *out[], int *nout, int max)
+// Appends a copy of path to out[] unless it is full. Returns -1 if full.
+{
+  if(*nout == max){
+    return -1;
+  }
+  if(nexpanded == expanded_max){
+    expanded_max = (expanded_max == 0) ? 64 : 2*expanded_max;
+    expanded = realloc(expanded, expanded_max * sizeof(char *));
+  }
+  expanded[nexpanded] = strdup(path);
+  out[(*nout)++] = expanded[nexpanded++];
+  return 0;
+}
+
+static int expand(char *done, char *rest, int listed, char *out[], int *nout, int max)
+/* Expands the pattern rest below the path done which has been matched
+  so far and ends in a / unless it is empty. listed is 1 if the last
+  component of done came from a directory listing so it is known to
+  exist. Matches are added to out[]. Returns -1 if there are more
+  than max matches.
+*/
+{
+  int done_len = strlen(done);
+  if(*rest == '\0'){
+    struct stat st;
+    int wants_dir = (done_len > 0 && done[done_len-1] == '/');
+    if((!listed || wants_dir) &&
+       (stat(done, &st) == -1 || (wants_dir && !S_ISDIR(st.st_mode)))){
+      return 0; // a literal part of the pattern which is not there
+    }
+    return add_match(done, out, nout, max);
+  }
+
+  char *slash = strchr(rest, '/');
+  int len = (slash != NULL) ? slash - rest : strlen(rest);
+  char *next = (slash != NULL) ? slash+1 : "";
+  char *path = malloc(done_len + NAME_MAX + strlen(rest) + 2);
+  int ret = 0;
+  if(!has_wildcard(rest, len)){ // taken as it is, checked for at the end
+    sprintf(path, "%s%.*s%s", done, len, rest, (slash != NULL) ? "/" : "");
+    ret = expand(path, next, 0, out, nout, max);
+  }
+  else{
+    char *pattern = strndup(rest, len);
+    if(done_len > 1){
+      done[done_len-1] = '\0'; // list "dir" rather than "dir/"
+    }
+    dir_listing_t *listing = list_dir((done_len == 0) ? "." : done);
+    if(done_len > 1){
+      done[done_len-1] = '/';
+    }
+    for(int i = 0; listing != NULL && i < listing->nnames && ret == 0; i++){
+      if(fnmatch(pattern, listing->names[i], FNM_PERIOD) == 0){
+        sprintf(path, "%s%s%s", done, listing->names[i], (slash != NULL) ? "/" : "");
+        ret = expand(path, next, 1, out, nout, max);
+      }
+    }
+    free(pattern);
+  }
+  free(path);
+  return ret;
+}
+
+int glob_token(char *tok, char *out[], int max)
+/* Expands a leading ~ or ~user of tok to the home directory and then
+  any wildcards in it, putting the matching paths in sorted order in
+  out[]. The strings belong to glob.c and last until the next call to
+  glob_release(). Returns the number of strings put in out[], 0 if tok
+  needs no expansion or matches nothing so it should be used as it is,
+  or -1 if it matches more than max paths.
+*/
+{
+  char *tilde = NULL;
+  if(tok[0] == '~'){
+    char *rest = tok + strcspn(tok, "/"); // after ~ or ~user
+    char *home = NULL;
+    if(rest == tok+1){
+      home = getenv("HOME");
+    }
+    else{
+      char *user = strndup(tok+1, rest - (tok+1));
+      struct passwd *pw = getpwnam(user);
+      home = (pw != NULL) ? pw->pw_dir : NULL;
+      free(user);
+    }
+    if(home != NULL){
+      tilde = malloc(strlen(home) + strlen(rest) + 1);
+      sprintf(tilde, "%s%s", home, rest);
+      tok = tilde;
+    }
+  }
+
+  int nout = 0;
+  if(has_wildcard(tok, strlen(tok))){
+    int ret = (tok[0] == '/') ? expand("/", tok+1, 0, out, &nout, max)
+                              : expand("", tok, 0, out, &nout, max);
+    if(ret == -1){
+      nout = -1;
+    }
+  }
+  if(nout == 0 && tilde != NULL){ // ~ is expanded even if the rest matches nothing
+    add_match(tilde, out, &nout, max);
+  }
+  free(tilde);
+  return nout;
+}
+
+void glob_release(void)
+// Frees the strings made by glob_token() since the last call.
+{
+  for(int i = 0; i < nexpanded; i++){
+    free(expanded[i]);
+  }
+  free(expanded);
+  expanded = NULL;
+  nexpanded = expanded_max = 0;
+}
@@ -0,0 +1,409 @@
+// libcommando.c: the job manager behind libcommando.h
+
+#include "commando.h"
+#include "libcommando.h"
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+
+// A commando_t wraps a cmdcol_t. Rather than a SIGCHLD handler, which
+// would take over a signal the host program may use itself, each
+// running job is watched through a pidfd, readable once the child
+// exits, and its output pipe. Both go in an epoll set whose fd is the
+// one the host polls, so the host never blocks on commando and
+// commando_process_events() only looks at the jobs which have
+// something to report. Kernels older than 5.3 have no pidfd_open();
+// there a timerfd in the set wakes the host every 10ms to sweep the
+// running jobs instead.
+//
+// A job is done, and its callback called, once it has been reaped and
+// its output has reached end of file. Usually both come together but a
+// job which leaves something running in the background holding its
+// output open, like sh -c 'sleep 100 &', is reaped first; its pipe
+// stays in the epoll set and is read as it becomes readable until the
+// end of file arrives, rather than blocking the host until then.
+
+#define EVENT_TIMER ((uint64_t) -1) // epoll data of the timerfd, others are job numbers
+#define MAX_EVENTS 64               // events taken per epoll_wait() call
+#define SWEEP_NS 10000000           // period of the timerfd sweep
+
+// jobwatch_t: what the manager knows of each job beyond its cmd_t
+typedef struct {
+  commando_done_t done;    // completion callback, NULL if none
+  void *arg;               // passed to done
+  int pidfd;               // readable once the child exits, -1 if none
+  int watched;             // 1 once a started job is in the epoll set
+  int piped;               // 1 while the output pipe is in the epoll set
+} jobwatch_t;
+
+struct commando {
+  cmdcol_t col;            // the jobs
+  jobwatch_t *watch;       // one per job
+  int watch_max;           // allocated length of watch
+  int epfd;                // epoll set handed out by commando_fd()
+  int timerfd;             // sweep timer for jobs without a pidfd, -1 until needed
+  int nswept;              // running jobs without a pidfd
+  int npending;            // jobs whose callbacks have yet to be called
+};
+
+static int job_done(cmd_t *cmd)
+// Returns 1 if cmd has been reaped and all of its output read.
+{
+  return cmd->finished && cmd->output_eof;
+}
+
+static int watch_fd(commando_t *mgr, int op, int fd, uint64_t data)
+// Adds or removes fd from the epoll set of mgr. Returns 0 or -1.
+{
+  struct epoll_event ev = { .events = EPOLLIN, .data.u64 = data };
+  return epoll_ctl(mgr->epfd, op, fd, &ev);
+}
+
+static void arm_timer(commando_t *mgr, int on)
+// Starts or stops the sweep timer, creating it the first time.
+{
+  if(mgr->timerfd == -1){
+    if(!on){
+      return;
+    }
+    mgr->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(mgr->timerfd == -1 || watch_fd(mgr, EPOLL_CTL_ADD, mgr->timerfd, EVENT_TIMER) == -1){
+      return; // nothing wakes the host, jobs are still found at the next call
+    }
+  }
+  struct itimerspec period = {
+    .it_interval = { .tv_nsec = on ? SWEEP_NS : 0 },
+    .it_value    = { .tv_nsec = on ? SWEEP_NS : 0 },
+  };
+  timerfd_settime(mgr->timerfd, 0, &period, NULL);
+}
+
+static void watch_started(commando_t *mgr)
+/* Puts the output pipe and a pidfd of each job started since the last
+  call into the epoll set. cmdcol_schedule() starts jobs as others
+  finish so this runs after every call to it.
+*/
+{
+  cmdcol_t *col = &mgr->col;
+  for(int i = 0; i < col->nlive; i++){
+    int job = col->live[i];
+    cmd_t *cmd = col->cmd[job];
+    jobwatch_t *w = &mgr->watch[job];
+    if(cmd->pid <= 0 || w->watched){
+      continue;
+    }
+    w->watched = 1;
+    if(!cmd->output_eof && watch_fd(mgr, EPOLL_CTL_ADD, cmd->out_pipe[PREAD], job) == 0){
+      w->piped = 1;
+    }
+    w->pidfd = syscall(SYS_pidfd_open, cmd->pid, 0);
+    if(w->pidfd != -1 && watch_fd(mgr, EPOLL_CTL_ADD, w->pidfd, job) == -1){
+      close(w->pidfd);
+      w->pidfd = -1;
+    }
+    if(w->pidfd == -1 && mgr->nswept++ == 0){
+      arm_timer(mgr, 1);
+    }
+  }
+}
+
+static int update_job(commando_t *mgr, int job, int *reaped)
+/* Drains the output of job and reaps it if it has exited, without
+  blocking, setting *reaped to 1 if it was reaped in this call. Once it
+  is done its fds leave the epoll set and its callback is called.
+  Returns 1 if the job was done in this call.
+*/
+{
+  cmd_t *cmd = mgr->col.cmd[job];
+  jobwatch_t *w = &mgr->watch[job];
+  if(cmd->pid <= 0 || job_done(cmd)){
+    return 0;
+  }
+  if(cmd->finished){
+    cmd_fetch_output(cmd); // reaped earlier, reads what has come since
+  }
+  else{
+    cmd_update_state(cmd, NOBLOCK); // drains the pipe before checking on the child
+    *reaped |= cmd->finished;
+    if(cmd->finished && w->pidfd != -1){
+      close(w->pidfd);
+      w->pidfd = -1;
+    }
+    else if(cmd->finished && --mgr->nswept == 0){
+      arm_timer(mgr, 0);
+    }
+  }
+  if(w->piped && job_done(cmd)){
+    w->piped = 0; // the pipe was closed as output was fetched, which drops it from the set
+  }
+  else if(w->piped && cmd->output_eof){
+    // a pipe at end of file stays readable so it must leave the set
+    watch_fd(mgr, EPOLL_CTL_DEL, cmd->out_pipe[PREAD], job);
+    w->piped = 0;
+  }
+  if(!job_done(cmd)){
+    return 0;
+  }
+  mgr->npending--;
+  cmdcol_sync(&mgr->col, job); // the output may have ended after the job left the live list
+  if(w->done != NULL){
+    w->done(mgr, job, cmd->status, cmd->str_status, w->arg); // may add jobs, so no pointers are kept
+  }
+  return 1;
+}
+
+commando_t *commando_open(int max_running, int *err)
+/*
+  Creates a job manager which runs at most max_running jobs at once,
+  or any number if max_running is 0. Returns NULL and sets *err, if
+  err is not NULL, on failure.
+*/
+{
+  int code = COMMANDO_OK;
+  commando_t *mgr = calloc(1, sizeof(commando_t));
+  if(mgr == NULL){
+    code = COMMANDO_ENOMEM;
+  }
+  else if(max_running < 0){
+    code = COMMANDO_EINVAL;
+  }
+  else if((mgr->epfd = epoll_create1(EPOLL_CLOEXEC)) == -1){
+    code = COMMANDO_ESYS;
+  }
+  if(err != NULL){
+    *err = code;
+  }
+  if(code != COMMANDO_OK){
+    free(mgr);
+    return NULL;
+  }
+  mgr->col.max_running = max_running;
+  mgr->timerfd = -1;
+  cmd_set_embedded(1); // nothing is printed, callbacks say when jobs finish
+  return mgr;
+}
+
+int commando_add(commando_t *mgr, char *argv[], commando_done_t done, void *arg)
+/*
+  Adds a job running argv, a NULL-terminated array which is copied,
+  with standard input from /dev/null. The job starts now unless
+  max_running jobs are already running, in which case it starts when
+  one of them finishes. done, which may be NULL, is called with arg
+  once the job finishes. Returns the job number, COMMANDO_EINVAL if
+  argv is empty, or COMMANDO_ENOMEM.
+*/
+{
+  if(argv == NULL || argv[0] == NULL){
+    return COMMANDO_EINVAL;
+  }
+  if(mgr->col.size == mgr->watch_max){
+    int watch_max = (mgr->watch_max == 0) ? MAX_CMDS : 2*mgr->watch_max;
+    jobwatch_t *watch = realloc(mgr->watch, watch_max * sizeof(jobwatch_t));
+    if(watch == NULL){
+      return COMMANDO_ENOMEM;
+    }
+    mgr->watch = watch;
+    mgr->watch_max = watch_max;
+  }
+  cmd_t *cmd = cmd_new(argv);
+  int job = cmdcol_add(&mgr->col, cmd);
+  if(job == -1){
+    cmd_free(cmd);
+    return COMMANDO_ENOMEM;
+  }
+  mgr->watch[job] = (jobwatch_t) { .done = done, .arg = arg, .pidfd = -1 };
+  mgr->npending++;
+  cmdcol_schedule(&mgr->col);
+  watch_started(mgr);
+  return job;
+}
+
+int commando_fd(commando_t *mgr)
+/*
+  Returns an fd which becomes readable when a job has output to read
+  or has finished, for the host to put in its own poll() or epoll set.
+  commando_process_events() should then be called.
+*/
+{
+  return mgr->epfd;
+}
+
+int commando_process_events(commando_t *mgr)
+/*
+  Reads the output of jobs which have some, reaps those which have
+  exited, calls their callbacks, and starts queued jobs in their
+  place. Never blocks. Returns the number of jobs which finished, or
+  COMMANDO_ESYS if epoll_wait() failed.
+*/
+{
+  struct epoll_event events[MAX_EVENTS];
+  int nfinished = 0;
+  int reaped = 0;
+  int sweep = 0;
+  int n;
+  do{
+    n = epoll_wait(mgr->epfd, events, MAX_EVENTS, 0);
+    if(n == -1 && errno == EINTR){
+      continue;
+    }
+    if(n == -1){
+      return COMMANDO_ESYS;
+    }
+    for(int i = 0; i < n; i++){
+      if(events[i].data.u64 == EVENT_TIMER){
+        uint64_t ticks;
+        read(mgr->timerfd, &ticks, sizeof(ticks)); // clears it
+        sweep = 1;
+      }
+      else{
+        nfinished += update_job(mgr, (int) events[i].data.u64, &reaped);
+      }
+    }
+  } while(n == MAX_EVENTS || (n == -1 && errno == EINTR));
+
+  for(int i = 0; sweep && i < mgr->col.nlive; i++){ // jobs without a pidfd
+    nfinished += update_job(mgr, mgr->col.live[i], &reaped);
+  }
+  if(reaped){
+    cmdcol_schedule(&mgr->col); // drops finished jobs from the live list, starts queued ones
+    watch_started(mgr);
+  }
+  return nfinished;
+}
+
+int commando_pending(commando_t *mgr)
+// Returns the number of jobs, running or queued, which have not finished.
+{
+  return mgr->npending;
+}
+
+static cmd_t *finished_job(commando_t *mgr, int job, int *err)
+// Looks up a job which must have finished, setting *err if it has not.
+{
+  if(job < 0 || job >= mgr->col.size){
+    *err = COMMANDO_ENOJOB;
+    return NULL;
+  }
+  cmd_t *cmd = mgr->col.cmd[job];
+  *err = !job_done(cmd) ? COMMANDO_ERUNNING :
+         !cmd_output_in_memory(cmd) ? COMMANDO_ENOOUTPUT : COMMANDO_OK;
+  return (*err == COMMANDO_OK) ? cmd : NULL;
+}
+
+int commando_output(commando_t *mgr, int job, const char **buf, int *size)
+/*
+  Points *buf at the output of a finished job, null-terminated, and
+  sets *size to its length. The buffer belongs to the manager and
+  stays valid until the job is released or the manager closed.
+  Output kept in segments is joined into one buffer by this call;
+  commando_write_output() avoids that. Returns COMMANDO_OK or an
+  error code.
+*/
+{
+  int err;
+  cmd_t *cmd = finished_job(mgr, job, &err);
+  if(cmd == NULL){
+    return err;
+  }
+  char *output = cmd_join_output(cmd);
+  if(output == NULL){
+    return COMMANDO_ENOMEM;
+  }
+  *buf = output;
+  *size = cmd->output_size;
+  return COMMANDO_OK;
+}
+
+int commando_write_output(commando_t *mgr, int job, int fd)
+/*
+  Writes the output of a finished job to fd with writev(), blocking
+  until it is all written. Returns COMMANDO_OK or an error code.
+*/
+{
+  int err;
+  cmd_t *cmd = finished_job(mgr, job, &err);
+  if(cmd == NULL){
+    return err;
+  }
+  return (cmd_write_output(cmd, fd, 0) == -1) ? COMMANDO_ESYS : COMMANDO_OK;
+}
+
+int commando_release(commando_t *mgr, int job)
+/*
+  Frees the output of a finished job once the host has no more use
+  for it; the job itself keeps its number and status. A host running
+  many jobs should release each one's output so memory stays bounded.
+  Returns COMMANDO_OK or an error code.
+*/
+{
+  int err;
+  cmd_t *cmd = finished_job(mgr, job, &err);
+  if(cmd == NULL){
+    return err;
+  }
+  cmd_discard_output(cmd);
+  return COMMANDO_OK;
+}
+
+int commando_signal(commando_t *mgr, int job, int sig)
+/*
+  Sends sig to the process group of a running job, so whatever it
+  started gets it too. Returns COMMANDO_OK, COMMANDO_ENOJOB if
+  there is no such job or it is not running, or COMMANDO_ESYS.
+*/
+{
+  if(job < 0 || job >= mgr->col.size ||
+     mgr->col.cmd[job]->pid <= 0 || mgr->col.cmd[job]->finished){
+    return COMMANDO_ENOJOB;
+  }
+  pid_t pid = mgr->col.cmd[job]->pid;
+  if(kill(-pid, sig) == -1 && kill(pid, sig) == -1){ // no group if the child has not got to setpgid()
+    return COMMANDO_ESYS;
+  }
+  return COMMANDO_OK;
+}
+
+void commando_close(commando_t *mgr)
+/*
+  Kills the process groups of any jobs still running, reaps them
+  without calling their callbacks, and frees the manager and all
+  output.
+*/
+{
+  cmdcol_t *col = &mgr->col;
+  for(int i = 0; i < col->nlive; i++){
+    int job = col->live[i];
+    cmd_t *cmd = col->cmd[job];
+    if(cmd->pid > 0 && !cmd->finished){
+      if(kill(-cmd->pid, SIGKILL) == -1){ // takes its children too, or just it if it has no group yet
+        kill(cmd->pid, SIGKILL);
+      }
+      cmd_update_state(cmd, DOBLOCK); // reaps it
+    }
+    if(mgr->watch[job].pidfd != -1){
+      close(mgr->watch[job].pidfd);
+    }
+  }
+  cmdcol_freeall(col);
+  if(mgr->timerfd != -1){
+    close(mgr->timerfd);
+  }
+  close(mgr->epfd);
+  free(mgr->watch);
+  free(mgr);
+}
+
+const char *commando_strerror(int err)
+// Returns a description of a COMMANDO_E* code.
+{
+  switch(err){
+    case COMMANDO_OK:        return "success";
+    case COMMANDO_ENOMEM:    return "out of memory";
+    case COMMANDO_ESYS:      return "system call failed";
+    case COMMANDO_EINVAL:    return "invalid argument";
+    case COMMANDO_ENOJOB:    return "no such job";
+    case COMMANDO_ERUNNING:  return "job has not finished";
+    case COMMANDO_ENOOUTPUT: return "output was released";
+  }
+  return "unknown error";
+}
@@ -0,0 +1,64 @@
+// libcommando.h: the job manager of commando as a library
+//
+// Runs child processes and captures their output without a shell
+// and without blocking, for programs with an event loop of their own.
+// Build with 'make lib' and link with libcommando.a or libcommando.so.
+//
+//   int err;
+//   commando_t *mgr = commando_open(64, &err);   // at most 64 running at once
+//   char *argv[] = {"gcc", "-c", "big.c", NULL};
+//   commando_add(mgr, argv, on_done, NULL);      // on_done(mgr, job, ...) once it finishes
+//   ... add commando_fd(mgr) to epoll/poll for reading; whenever it is
+//   readable call commando_process_events(mgr) ...
+//   commando_close(mgr);
+//
+// Jobs are numbered from 0 in the order added. Nothing is printed and
+// nothing calls exit(): functions returning int give a COMMANDO_E*
+// code below 0 on failure. The manager is not thread safe and there
+// should be only one per process, as the module state of the job
+// machinery underneath, such as the PATH cache, is shared.
+
+#ifndef LIBCOMMANDO_H
+#define LIBCOMMANDO_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Error codes, all below 0 so they cannot be mistaken for job numbers.
+#define COMMANDO_OK         0
+#define COMMANDO_ENOMEM    -1 // memory ran out
+#define COMMANDO_ESYS      -2 // a system call failed, errno says why
+#define COMMANDO_EINVAL    -3 // bad argument such as an empty argv
+#define COMMANDO_ENOJOB    -4 // no job with that number
+#define COMMANDO_ERUNNING  -5 // the job has not finished
+#define COMMANDO_ENOOUTPUT -6 // the output of the job was released
+
+typedef struct commando commando_t; // opaque job manager
+
+// Called from commando_process_events() once for each job which
+// finishes. status is the exit status, 128+signal if the job was
+// killed, and str_status describes it as EXIT(0), SIGNALED(9) or
+// FAILED(2) if the command could not be run. The output of the job
+// may be read in the callback and more jobs may be added, but the
+// manager must not be closed.
+typedef void (*commando_done_t)(commando_t *mgr, int job, int status,
+                                const char *str_status, void *arg);
+
+commando_t *commando_open(int max_running, int *err);
+int commando_add(commando_t *mgr, char *argv[], commando_done_t done, void *arg);
+int commando_fd(commando_t *mgr);
+int commando_process_events(commando_t *mgr);
+int commando_pending(commando_t *mgr);
+int commando_output(commando_t *mgr, int job, const char **buf, int *size);
+int commando_write_output(commando_t *mgr, int job, int fd);
+int commando_release(commando_t *mgr, int job);
+int commando_signal(commando_t *mgr, int job, int sig);
+void commando_close(commando_t *mgr);
+const char *commando_strerror(int err);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,211 @@
+// pathcache.c: cache of command names resolved through PATH
+
+#include "commando.h"
+
+// The cache is a hash table with open addressing from command names
+// such as "ls" to the absolute paths found for them in PATH. It is
+// thrown away whenever PATH changes or a directory in PATH is
+// modified, which is checked at most every PATH_CHECK_NANOS so a
+// burst of job starts costs a few stat() calls rather than a walk of
+// PATH in every child.
+#define PATH_CHECK_NANOS 100000000LL // 100ms
+#define PATH_MIN_SLOTS 64
+
+typedef struct {
+  char *name;              // command name, NULL for an empty slot
+  char *path;              // absolute path it resolved to
+  int hits;                // number of jobs started through this entry
+} path_entry_t;
+
+typedef struct {
+  time_t sec;              // mtime of a directory in PATH
+  long nsec;
+} dir_mtime_t;
+
+static path_entry_t *slots = NULL; // hash table, nslots long
+static int nslots = 0;
+static int nentries = 0;
+static char *cached_path_env = NULL; // value of PATH the entries came from
+static dir_mtime_t *dir_mtimes = NULL; // mtime of each PATH directory at that time
+static int ndirs = 0;
+static long long last_check = 0;   // when PATH and the directories were last checked
+
+static unsigned long hash_name(char *name)
+// FNV-1a hash of a command name.
+{
+  unsigned long hash = 14695981039346656037UL;
+  for(; *name != '\0'; name++){
+    hash = (hash ^ (unsigned char) *name) * 1099511628211UL;
+  }
+  return hash;
+}
+
+static char *next_dir(char **rest)
+// Splits the next directory off a copy of PATH at *rest, NULL at the
+// end. An empty entry means the current directory, as for execvp().
+{
+  char *dir = strsep(rest, ":");
+  return (dir != NULL && *dir == '\0') ? "." : dir;
+}
+
+static int dir_mtimes_changed(int record)
+/* Stats every directory in PATH and compares each mtime with the one
+  recorded when the cache was filled. With record set, records the
+  current mtimes instead. Returns 1 if any changed.
+*/
+{
+  char *path_env = getenv("PATH");
+  char *dirs = strdup((path_env != NULL) ? path_env : "");
+  int changed = 0, i = 0;
+  for(char *rest = dirs, *dir = next_dir(&rest); dir != NULL; dir = next_dir(&rest), i++){
+    struct stat st;
+    dir_mtime_t now = {0, 0};
+    if(stat(dir, &st) == 0){
+      now.sec = st.st_mtim.tv_sec;
+      now.nsec = st.st_mtim.tv_nsec;
+    }
+    if(record){
+      dir_mtimes = realloc(dir_mtimes, (i+1) * sizeof(dir_mtime_t));
+      dir_mtimes[i] = now;
+      ndirs = i+1;
+    }
+    else if(i >= ndirs || dir_mtimes[i].sec != now.sec || dir_mtimes[i].nsec != now.nsec){
+      changed = 1;
+      break;
+    }
+  }
+  free(dirs);
+  return changed;
+}
+
+void path_cache_clear(void)
+// Forgets every cached path, as for 'hash -r'.
+{
+  for(int i = 0; i < nslots; i++){
+    free(slots[i].name);
+    free(slots[i].path);
+  }
+  free(slots);
+  slots = NULL;
+  nslots = nentries = 0;
+  free(cached_path_env);
+  cached_path_env = NULL;
+  free(dir_mtimes);
+  dir_mtimes = NULL;
+  ndirs = 0;
+}
+
+static void check_cache(void)
+// Clears the cache if PATH or any directory in it changed since it
+// was filled. Only checks every PATH_CHECK_NANOS.
+{
+  long long now = now_nanos();
+  if(nentries == 0 || now - last_check < PATH_CHECK_NANOS){
+    return;
+  }
+  last_check = now;
+  char *path_env = getenv("PATH");
+  if(path_env == NULL || cached_path_env == NULL || strcmp(path_env, cached_path_env) != 0 ||
+     dir_mtimes_changed(0)){
+    path_cache_clear();
+  }
+}
+
+static path_entry_t *find_slot(char *name)
+// Slot holding name or the empty slot where it belongs.
+{
+  unsigned long i = hash_name(name) & (nslots - 1);
+  while(slots[i].name != NULL && strcmp(slots[i].name, name) != 0){
+    i = (i + 1) & (nslots - 1);
+  }
+  return &slots[i];
+}
+
+static void insert_entry(char *name, char *path, int hits)
+// Adds name to the table, doubling it when it gets half full.
+{
+  if(2*(nentries+1) > nslots){
+    path_entry_t *old = slots;
+    int nold = nslots;
+    nslots = (nslots == 0) ? PATH_MIN_SLOTS : 2*nslots;
+    slots = calloc(nslots, sizeof(path_entry_t));
+    for(int i = 0; i < nold; i++){
+      if(old[i].name != NULL){
+        *find_slot(old[i].name) = old[i];
+      }
+    }
+    free(old);
+  }
+  path_entry_t *slot = find_slot(name);
+  slot->name = strdup(name);
+  slot->path = strdup(path);
+  slot->hits = hits;
+  nentries++;
+}
+
+char *path_lookup(char *name)
+/* Returns the absolute path of the executable that running name
+  would run, searching PATH the way execvp() does and caching the
+  result. Names containing a / are returned unchanged. Returns NULL if
+  name is not found in PATH; nothing is cached then so the caller can
+  fall back to execvp() for the error. The returned string belongs to
+  the cache.
+*/
+{
+  if(strchr(name, '/') != NULL){
+    return name;
+  }
+  check_cache();
+  if(nslots > 0){
+    path_entry_t *slot = find_slot(name);
+    if(slot->name != NULL){
+      slot->hits++;
+      return slot->path;
+    }
+  }
+
+  char *path_env = getenv("PATH");
+  if(path_env == NULL){
+    return NULL;
+  }
+  if(nentries == 0){ // first entry, note what it depends on
+    static int registered = 0;
+    if(!registered){
+      atexit(path_cache_clear); // leave nothing allocated at exit
+      registered = 1;
+    }
+    free(cached_path_env);
+    cached_path_env = strdup(path_env);
+    dir_mtimes_changed(1);
+    last_check = now_nanos();
+  }
+  char *dirs = strdup(path_env);
+  char candidate[MAX_LINE];
+  char *found = NULL;
+  for(char *rest = dirs, *dir = next_dir(&rest); dir != NULL; dir = next_dir(&rest)){
+    snprintf(candidate, sizeof(candidate), "%s/%s", dir, name);
+    struct stat st;
+    if(stat(candidate, &st) == 0 && S_ISREG(st.st_mode) && access(candidate, X_OK) == 0){
+      insert_entry(name, candidate, 1);
+      found = find_slot(name)->path;
+      break;
+    }
+  }
+  free(dirs);
+  return found;
+}
+
+void path_cache_print(void)
+// Lists the cache for the hash builtin as hits and path of each entry.
+{
+  if(nentries == 0){
+    printf("hash: cache is empty\n");
+    return;
+  }
+  printf("%-6s %s\n", "HITS", "COMMAND");
+  for(int i = 0; i < nslots; i++){
+    if(slots[i].name != NULL){
+      printf("%-6d %s\n", slots[i].hits, slots[i].path);
+    }
+  }
+}
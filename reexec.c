@@ -0,0 +1,486 @@
+// reexec.c: the reexec builtin, restarting commando without losing jobs
+
+#include "commando.h"
+
+// reexec runs a fresh copy of the commando binary, usually one just
+// rebuilt, in place of the running one. execve() keeps the process
+// and so its children: running jobs carry on and are still ours to
+// reap. What the old program knew about its jobs, the whole job table
+// with captured output, goes into a memfd whose number is passed to
+// the new program as --adopt FD. The fds of running jobs have their
+// close-on-exec flag cleared so they survive the exec under the same
+// numbers. Finished output is written at page boundaries of the memfd
+// so the new program maps it where it lies rather than copying it.
+//
+// The state is a stream of native ints and structs which only a build
+// of the same STATE_VERSION can read; it never outlives the exec.
+
+#define STATE_MAGIC "commando-state"
+#define STATE_VERSION 1  // bump whenever what is written below changes
+#define KEPT_NONE 0      // output of a job: not in memory, or still being read
+#define KEPT_COPIED 1    //   written inline and copied back
+#define KEPT_MAPPED 2    //   written at a page boundary and mapped back
+
+// Writing: short writes are caught by ferror() once all is written
+static void put(FILE *out, void *data, size_t size)
+{
+  if(size > 0){
+    fwrite(data, size, 1, out);
+  }
+}
+
+static void put_int(FILE *out, int val)
+{
+  put(out, &val, sizeof(val));
+}
+
+static void put_str(FILE *out, char *str)
+// Writes the length of str and its bytes, -1 for NULL.
+{
+  int len = (str != NULL) ? strlen(str) : -1;
+  put_int(out, len);
+  put(out, str, (len > 0) ? len : 0);
+}
+
+static void put_argv(FILE *out, char **argv)
+{
+  int argc = 0;
+  while(argv[argc] != NULL){
+    argc++;
+  }
+  put_int(out, argc);
+  for(int i = 0; i < argc; i++){
+    put_str(out, argv[i]);
+  }
+}
+
+static void skip_to_page(FILE *stream)
+// Moves stream on to the next page boundary of the file, if not at one.
+{
+  long page = sysconf(_SC_PAGESIZE);
+  long pos = ftell(stream);
+  fseek(stream, (page - pos % page) % page, SEEK_CUR); // a hole when writing
+}
+
+// Reading: the stream was written by the old program just before the
+// exec so it is trusted beyond checks which keep allocations sane
+static int get(FILE *in, void *data, size_t size)
+{
+  return size == 0 || fread(data, size, 1, in) == 1;
+}
+
+static int get_int(FILE *in)
+{
+  int val = -1;
+  get(in, &val, sizeof(val));
+  return val;
+}
+
+static char *get_str(FILE *in)
+{
+  int len = get_int(in);
+  if(len < 0 || len > MAX_LINE * ARG_MAX){
+    return NULL;
+  }
+  char *str = malloc(len + 1);
+  if(str == NULL){
+    return NULL;
+  }
+  get(in, str, len);
+  str[len] = '\0';
+  return str;
+}
+
+static char **get_argv(FILE *in)
+// Returns a malloc()'d NULL-terminated argv, or NULL if it is malformed.
+{
+  int argc = get_int(in);
+  if(argc < 1 || argc > ARG_MAX){
+    return NULL;
+  }
+  char **argv = calloc(argc + 1, sizeof(char *));
+  for(int i = 0; argv != NULL && i < argc; i++){
+    argv[i] = get_str(in);
+  }
+  return argv;
+}
+
+static void free_argv(char **argv)
+{
+  for(int i = 0; argv != NULL && argv[i] != NULL; i++){
+    free(argv[i]);
+  }
+  free(argv);
+}
+
+static void keep_fds(cmdcol_t *col, int keep)
+/* Clears the close-on-exec flag of the fds of each running job if keep
+  is 1 so they survive the exec, or sets it again if keep is 0 so they
+  are not leaked into jobs started later.
+*/
+{
+  for(int i = 0; i < col->nlive; i++){
+    cmd_t *cmd = col->cmd[col->live[i]];
+    if(cmd->pid == -1 || cmd->finished){
+      continue;
+    }
+    int fds[] = { (cmd->capture_fd == -1) ? cmd->out_pipe[PREAD] : -1, cmd->exec_pipe, cmd->capture_fd };
+    for(int f = 0; f < 3; f++){
+      if(fds[f] != -1){
+        fcntl(fds[f], F_SETFD, keep ? 0 : FD_CLOEXEC);
+      }
+    }
+  }
+}
+
+static int input_job(cmdcol_t *col, cmd_t *cmd)
+// Returns the job whose output a job yet to start will be fed, or -1.
+{
+  if(cmd->pid != -1 || cmd->input == NULL){
+    return -1;
+  }
+  for(int i = 0; i < col->size; i++){
+    if(col->cmd[i]->output == cmd->input){
+      return i;
+    }
+  }
+  return -1;
+}
+
+static void save_cmd(cmdcol_t *col, cmd_t *cmd, FILE *out)
+// Writes everything about cmd which the new program needs.
+{
+  put_argv(out, cmd->argv);
+  put_int(out, cmd->pid);
+  put_int(out, cmd->finished);
+  put_int(out, cmd->stopped);
+  put_int(out, cmd->status);
+  put(out, cmd->str_status, sizeof(cmd->str_status));
+  put_int(out, cmd->exec_errno);
+  put_int(out, cmd->capture);
+  put_int(out, cmd->output_eof);
+  put(out, &cmd->times, sizeof(cmd->times));
+  put(out, &cmd->last_used, sizeof(cmd->last_used));
+  put_str(out, cmd->input_file);
+  put_int(out, input_job(col, cmd));
+  put_int(out, cmd->input_size);
+  put_int(out, cmd->after_ok);
+  put_int(out, cmd->nafter);
+  put(out, cmd->after, cmd->nafter * sizeof(int));
+  put_str(out, cmd->spill_file);
+  put_int(out, cmd->nchunks);
+  put(out, cmd->chunks, cmd->nchunks * sizeof(outchunk_t));
+
+  // fds of a running job, which keep their numbers across the exec
+  int running = (cmd->pid != -1 && !cmd->finished);
+  put_int(out, (running && cmd->capture_fd == -1) ? cmd->out_pipe[PREAD] : -1);
+  put_int(out, running ? cmd->exec_pipe : -1);
+  put_int(out, running ? cmd->capture_fd : -1);
+
+  // output drained so far from a running job, or all of it once
+  // finished; output of a segment or more starts at a page boundary
+  // to be mapped, smaller output is copied as mapping every one of
+  // thousands of jobs would run into the limit on mappings
+  int kept = !(cmd->finished && cmd_output_in_memory(cmd)) ? KEPT_NONE :
+             (cmd->output_size < SEGMENT_SIZE) ? KEPT_COPIED : KEPT_MAPPED;
+  put_int(out, cmd->output_size);
+  put_int(out, cmd->drained_size);
+  put(out, &cmd->cut_size, sizeof(cmd->cut_size));
+  put_int(out, kept);
+  if(kept == KEPT_MAPPED){
+    skip_to_page(out);
+  }
+  if(kept != KEPT_NONE && cmd->output != NULL){
+    put(out, cmd->output, cmd->output_size);
+  }
+  else if(kept != KEPT_NONE || running){
+    for(outseg_t *seg = cmd->segs; seg != NULL; seg = seg->next){
+      put(out, seg->data, seg->len);
+    }
+  }
+  if(kept != KEPT_NONE){
+    put(out, "", 1); // the null that ends output, mapped along with it
+  }
+
+  // on-output triggers along with where matching had got to
+  matcher_t *m = cmd->matcher;
+  put_int(out, (m != NULL) ? m->ntriggers : 0);
+  for(int t = 0; m != NULL && t < m->ntriggers; t++){
+    put_str(out, m->triggers[t].pattern);
+    put_int(out, m->triggers[t].action);
+    if(m->triggers[t].action == TRIGGER_RUN){
+      put_argv(out, m->triggers[t].argv);
+    }
+  }
+  if(m != NULL && m->ntriggers > 0){
+    put(out, &m->fired, sizeof(m->fired));
+    put_int(out, m->state);
+  }
+}
+
+static cmd_t *adopt_cmd(FILE *in, int fd, int *input_job)
+/* Reads back a cmd written by save_cmd() from in, which reads the
+  memfd fd, setting *input_job to the job whose output it is to be
+  fed. Returns the cmd or NULL if the state is malformed.
+*/
+{
+  char **argv = get_argv(in);
+  if(argv == NULL || argv[0] == NULL){
+    free_argv(argv);
+    return NULL;
+  }
+  cmd_t *cmd = cmd_new(argv);
+  free_argv(argv);
+  cmd->pid = get_int(in);
+  cmd->finished = get_int(in);
+  cmd->stopped = get_int(in);
+  cmd->status = get_int(in);
+  get(in, cmd->str_status, sizeof(cmd->str_status));
+  cmd->str_status[STATUS_LEN] = '\0';
+  cmd->exec_errno = get_int(in);
+  cmd->capture = get_int(in);
+  cmd->output_eof = get_int(in);
+  get(in, &cmd->times, sizeof(cmd->times));
+  get(in, &cmd->last_used, sizeof(cmd->last_used));
+  cmd->input_file = get_str(in);
+  *input_job = get_int(in);
+  cmd->input_size = get_int(in);
+  cmd->after_ok = get_int(in);
+  int nafter = get_int(in);
+  if(nafter > 0){
+    cmd->after = malloc(nafter * sizeof(int));
+    if(cmd->after == NULL){
+      cmd_free(cmd);
+      return NULL;
+    }
+    cmd->nafter = nafter;
+    get(in, cmd->after, nafter * sizeof(int));
+  }
+  cmd->spill_file = get_str(in);
+  int nchunks = get_int(in);
+  if(nchunks > 0){
+    cmd->chunks = malloc(nchunks * sizeof(outchunk_t));
+    if(cmd->chunks == NULL){
+      cmd_free(cmd);
+      return NULL;
+    }
+    cmd->nchunks = cmd->chunks_max = nchunks;
+    get(in, cmd->chunks, nchunks * sizeof(outchunk_t));
+  }
+  cmd->out_pipe[PREAD] = get_int(in);
+  cmd->exec_pipe = get_int(in);
+  cmd->capture_fd = get_int(in);
+
+  cmd->output_size = get_int(in);
+  cmd->drained_size = get_int(in);
+  get(in, &cmd->cut_size, sizeof(cmd->cut_size));
+  int kept = get_int(in);
+  if(kept == KEPT_MAPPED){
+    skip_to_page(in);
+    void *map = mmap(NULL, cmd->output_size + 1, PROT_READ, MAP_PRIVATE, fd, ftell(in));
+    if(map != MAP_FAILED){
+      cmd->output = map;
+      cmd->output_mapped = 1;
+      fseek(in, cmd->output_size + 1, SEEK_CUR);
+    }
+  }
+  if(kept != KEPT_NONE && cmd->output == NULL){ // copied, or the mapping failed
+    cmd->output = malloc(cmd->output_size + 1);
+    if(cmd->output == NULL){
+      cmd_free(cmd);
+      return NULL;
+    }
+    get(in, cmd->output, cmd->output_size + 1);
+  }
+  if(kept == KEPT_NONE && cmd->pid != -1 && !cmd->finished){
+    for(int left = cmd->drained_size; left > 0; ){ // refill segments to carry on reading into
+      outseg_t *seg = segment_get();
+      if(seg == NULL){
+        cmd_free(cmd);
+        return NULL;
+      }
+      seg->len = (left < SEGMENT_SIZE) ? left : SEGMENT_SIZE;
+      get(in, seg->data, seg->len);
+      left -= seg->len;
+      if(cmd->segs == NULL){
+        cmd->segs = seg;
+      }
+      else{
+        cmd->segs_tail->next = seg;
+      }
+      cmd->segs_tail = seg;
+    }
+  }
+
+  int ntriggers = get_int(in);
+  for(int t = 0; t < ntriggers; t++){
+    char *pattern = get_str(in);
+    int action = get_int(in);
+    char **trigger_argv = (action == TRIGGER_RUN) ? get_argv(in) : NULL;
+    if(pattern != NULL){
+      cmd_add_trigger(cmd, pattern, action, trigger_argv);
+    }
+    free(pattern);
+    free_argv(trigger_argv);
+  }
+  if(ntriggers > 0){
+    unsigned long long fired = 0;
+    get(in, &fired, sizeof(fired));
+    int state = get_int(in);
+    if(cmd->matcher != NULL){
+      cmd->matcher->fired = fired;
+      cmd->matcher->state = state;
+    }
+  }
+  if(ferror(in) || feof(in)){
+    cmd_free(cmd);
+    return NULL;
+  }
+  return cmd;
+}
+
+static int save_state(cmdcol_t *col, FILE *out)
+// Writes the settings and jobs of col and unread input to out.
+{
+  char unread[MAX_LINE];
+  int nunread = input_save(unread); // lines already read from stdin but not run
+  put(out, STATE_MAGIC, sizeof(STATE_MAGIC));
+  put_int(out, STATE_VERSION);
+  put_int(out, col->max_running);
+  put(out, &col->output_budget, sizeof(col->output_budget));
+  put_int(out, col->capture);
+  put_int(out, col->ngroups);
+  put(out, col->groups, col->ngroups * sizeof(cmdgroup_t));
+  put_int(out, nunread);
+  put(out, unread, nunread);
+  put_int(out, col->size);
+  for(int i = 0; i < col->size; i++){
+    save_cmd(col, col->cmd[i], out);
+  }
+  fflush(out);
+  return ferror(out) ? -1 : 0;
+}
+
+int cmdcol_reexec(cmdcol_t *col, char *path, char *argv[])
+/* Runs the commando at path in place of this one, passing it the jobs
+  of col to carry on with. argv is the argv of main(), reused for the
+  new program so options such as --echo and --trace still apply, with
+  --adopt FD added. Does not return if the exec succeeds. Otherwise
+  leaves everything as it was, prints why and returns -1.
+*/
+{
+  if(access(path, X_OK) == -1){ // fail before any work if it cannot run
+    printf("reexec: cannot run %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  cmdcol_run_triggers(col); // jobs for triggers which have already fired
+  int fd = memfd_create("commando-state", 0); // not close-on-exec, the new program reads it
+  FILE *out = (fd != -1) ? fdopen(dup(fd), "w") : NULL;
+  if(out == NULL || save_state(col, out) == -1){
+    printf("reexec: cannot save jobs: %s\n", strerror(errno));
+    if(out != NULL){
+      fclose(out);
+    }
+    if(fd != -1){
+      close(fd);
+    }
+    return -1;
+  }
+  fclose(out);
+  lseek(fd, 0, SEEK_SET); // shared with the dup, the new program reads from the start
+
+  int argc = 0;
+  while(argv[argc] != NULL){
+    argc++;
+  }
+  char fd_str[32];
+  snprintf(fd_str, sizeof(fd_str), "%d", fd);
+  char **new_argv = malloc((argc + 3) * sizeof(char *));
+  int n = 0;
+  for(int i = 0; i < argc; i++){
+    if(strcmp(argv[i], "--adopt") == 0 && i+1 < argc){
+      i++; // from an earlier reexec
+      continue;
+    }
+    new_argv[n++] = argv[i];
+  }
+  new_argv[n++] = "--adopt";
+  new_argv[n++] = fd_str;
+  new_argv[n] = NULL;
+
+  keep_fds(col, 1);
+  fflush(stdout); // the buffer goes with the old program
+  execv(path, new_argv);
+
+  // Only get here if the exec failed
+  int err = errno;
+  keep_fds(col, 0);
+  close(fd);
+  free(new_argv);
+  printf("reexec: cannot run %s: %s\n", path, strerror(err));
+  return -1;
+}
+
+int cmdcol_adopt(cmdcol_t *col, int fd)
+/* Takes on the jobs handed over by cmdcol_reexec() in the memfd fd,
+  adding them to col, which should be empty, under the same job
+  numbers. Output of finished jobs is mapped from the memfd, which is
+  then closed. Prints how many jobs were adopted and returns that
+  number, or -1 if the state cannot be read, in which case the jobs
+  read so far are kept.
+*/
+{
+  FILE *in = fdopen(fd, "r");
+  if(in == NULL){
+    printf("reexec: cannot read jobs: %s\n", strerror(errno));
+    close(fd);
+    return -1;
+  }
+  char magic[sizeof(STATE_MAGIC)];
+  int ok = get(in, magic, sizeof(magic)) && memcmp(magic, STATE_MAGIC, sizeof(magic)) == 0 &&
+           get_int(in) == STATE_VERSION;
+  int njobs = 0, nrunning = 0;
+  if(ok){
+    col->max_running = get_int(in);
+    get(in, &col->output_budget, sizeof(col->output_budget));
+    col->capture = get_int(in);
+    int ngroups = get_int(in);
+    col->groups = (ngroups > 0) ? malloc(ngroups * sizeof(cmdgroup_t)) : NULL;
+    col->ngroups = (col->groups != NULL) ? ngroups : 0;
+    get(in, col->groups, col->ngroups * sizeof(cmdgroup_t));
+    char unread[MAX_LINE];
+    int nunread = get_int(in);
+    ok = (nunread >= 0 && nunread <= MAX_LINE && get(in, unread, nunread));
+    if(ok){
+      input_restore(unread, nunread);
+    }
+    njobs = get_int(in);
+  }
+  int *input_jobs = ok ? malloc((njobs + 1) * sizeof(int)) : NULL;
+  ok = ok && input_jobs != NULL;
+  for(int i = 0; ok && i < njobs; i++){
+    cmd_t *cmd = adopt_cmd(in, fd, &input_jobs[i]);
+    if(cmd == NULL || cmdcol_add(col, cmd) == -1){
+      if(cmd != NULL){
+        cmd_free(cmd);
+      }
+      ok = 0;
+      break;
+    }
+    nrunning += (cmd->pid != -1 && !cmd->finished);
+  }
+  for(int i = 0; input_jobs != NULL && i < col->size; i++){ // feed input once its job is back
+    if(input_jobs[i] >= 0 && input_jobs[i] < col->size){
+      col->cmd[i]->input = col->cmd[input_jobs[i]]->output;
+    }
+  }
+  free(input_jobs);
+  keep_fds(col, 0);
+  fclose(in); // the mappings of output keep what they need
+  if(!ok){
+    printf("reexec: cannot read jobs, %d of them adopted\n", col->size);
+    return -1;
+  }
+  printf("reexec: adopted %d jobs, %d running\n", col->size, nrunning);
+  return col->size;
+}
@@ -0,0 +1,86 @@
+// segment.c: fixed-size segments which hold job output, drawn from a pool
+
+#include "commando.h"
+
+// Output is read into a chain of SEGMENT_SIZE segments rather than one
+// buffer grown by doubling. Bytes already read never move so capture
+// costs the same per byte however large the output gets, and at most
+// the last segment of a chain is partly empty. Segments given back are
+// kept on a free list, up to SEGMENT_POOL_MAX of them, so jobs which
+// come and go reuse the same memory rather than going back to malloc().
+
+static outseg_t *pool = NULL;      // free segments linked through next
+static int npool = 0;
+
+static void segment_pool_clear(void)
+// Frees the segments on the free list, at exit.
+{
+  while(pool != NULL){
+    outseg_t *seg = pool;
+    pool = seg->next;
+    free(seg);
+  }
+  npool = 0;
+}
+
+outseg_t *segment_get(void)
+/* Returns an empty segment, from the pool if it has one, or NULL with
+  errno set if memory runs out.
+*/
+{
+  static int registered = 0;
+  if(!registered){
+    atexit(segment_pool_clear);
+    registered = 1;
+  }
+  outseg_t *seg = pool;
+  if(seg != NULL){
+    pool = seg->next;
+    npool--;
+  }
+  else{
+    seg = malloc(sizeof(outseg_t));
+    if(seg == NULL){
+      return NULL;
+    }
+  }
+  seg->next = NULL;
+  seg->len = 0;
+  return seg;
+}
+
+void segment_release(outseg_t *segs)
+// Gives every segment of the chain segs, which may be NULL, back to the pool.
+{
+  while(segs != NULL){
+    outseg_t *next = segs->next;
+    if(npool < SEGMENT_POOL_MAX){
+      segs->next = pool;
+      pool = segs;
+      npool++;
+    }
+    else{
+      free(segs);
+    }
+    segs = next;
+  }
+}
+
+char *segment_join(outseg_t *segs, int size)
+/* Copies the size bytes held in the chain segs into a single malloc()'d
+  buffer with a null after them and returns it, or NULL if memory runs
+  out. The chain is left as it is.
+*/
+{
+  char *buf = malloc(size + 1);
+  if(buf == NULL){
+    return NULL;
+  }
+  int pos = 0;
+  for(outseg_t *seg = segs; seg != NULL; seg = seg->next){
+    memcpy(buf + pos, seg->data, seg->len);
+    pos += seg->len;
+  }
+  buf[pos] = '\0';
+  return buf;
+}
@@ -0,0 +1,137 @@
+// stats.c: latency histograms for the phases in the life of jobs
+
+#include "commando.h"
+
+// Histograms are HDR-style: values below 16 get their own bucket and
+// every power of 2 above that is split into 16 linear sub-buckets, so
+// any recorded value is off by at most 1/16th (about 6%) while 1024
+// buckets cover every long long.
+#define HIST_SUB 16
+#define HIST_BUCKETS 1024
+
+typedef struct {
+  long long counts[HIST_BUCKETS]; // number of values in each bucket
+  long long count;                // total number of values
+  long long max;                  // largest value recorded
+} hist_t;
+
+// phase_t: a phase of a job between two of its timestamps
+typedef struct {
+  char *name;
+  int from;                // offset of the starting time in cmdtimes_t
+  int to;                  // offset of the ending time
+} phase_t;
+
+#define TIME_AT(times, offset) (*(long long *) ((char *) (times) + (offset)))
+
+static phase_t phases[] = {
+  {"queue",        offsetof(cmdtimes_t, created),      offsetof(cmdtimes_t, fork)},
+  {"fork",         offsetof(cmdtimes_t, fork),         offsetof(cmdtimes_t, forked)},
+  {"exec",         offsetof(cmdtimes_t, fork),         offsetof(cmdtimes_t, exec)},
+  {"first-output", offsetof(cmdtimes_t, exec),         offsetof(cmdtimes_t, first_output)},
+  {"run",          offsetof(cmdtimes_t, fork),         offsetof(cmdtimes_t, output_eof)},
+  {"reap",         offsetof(cmdtimes_t, output_eof),   offsetof(cmdtimes_t, reaped)},
+  {"capture",      offsetof(cmdtimes_t, reaped),       offsetof(cmdtimes_t, captured)},
+  {"total",        offsetof(cmdtimes_t, created),      offsetof(cmdtimes_t, captured)},
+  {NULL, 0, 0},
+};
+
+static int hist_bucket(long long value)
+// Index of the bucket holding value.
+{
+  if(value < HIST_SUB){
+    return value;
+  }
+  int exp = 63 - __builtin_clzll(value);  // value is in [2^exp, 2^(exp+1))
+  int sub = (value >> (exp-4)) & (HIST_SUB-1);
+  return (exp-3)*HIST_SUB + sub;
+}
+
+static long long hist_bucket_top(int bucket)
+// Largest value which falls in the given bucket.
+{
+  if(bucket < HIST_SUB){
+    return bucket;
+  }
+  int exp = bucket/HIST_SUB + 3;
+  int sub = bucket % HIST_SUB;
+  return ((long long) (HIST_SUB+sub+1) << (exp-4)) - 1;
+}
+
+static void hist_record(hist_t *hist, long long value)
+{
+  hist->counts[hist_bucket(value)]++;
+  hist->count++;
+  if(value > hist->max){
+    hist->max = value;
+  }
+}
+
+static long long hist_percentile(hist_t *hist, double pct)
+// Value at or below which pct percent of recorded values fall.
+{
+  long long rank = (long long) (pct/100.0 * hist->count + 0.999999);
+  long long seen = 0;
+  for(int i = 0; i < HIST_BUCKETS; i++){
+    seen += hist->counts[i];
+    if(seen >= rank && seen > 0){
+      long long top = hist_bucket_top(i);
+      return (top < hist->max) ? top : hist->max;
+    }
+  }
+  return hist->max;
+}
+
+static void format_nanos(long long nanos, char *buf, int size)
+// Formats a duration with units such as 950ns, 12.3us, 4.56ms, 1.20s.
+{
+  if(nanos < 1000){
+    snprintf(buf, size, "%lldns", nanos);
+  }
+  else if(nanos < 1000000){
+    snprintf(buf, size, "%.1fus", nanos / 1e3);
+  }
+  else if(nanos < 1000000000){
+    snprintf(buf, size, "%.2fms", nanos / 1e6);
+  }
+  else{
+    snprintf(buf, size, "%.2fs", nanos / 1e9);
+  }
+}
+
+void cmdcol_print_stats(cmdcol_t *col)
+/* Builds a histogram of how long each phase took over all jobs in col
+  which have reached the end of the phase and prints the median, 99th
+  percentile and maximum of each phase. The format is
+
+  PHASE           COUNT      P50      P99      MAX
+  queue               3    2.1us    3.0us    3.0us
+  fork                3  120.5us  180.2us  180.2us
+  ...
+
+  Phases no job has completed show - in place of times.
+*/
+{
+  printf("%-12s %8s %8s %8s %8s\n", "PHASE", "COUNT", "P50", "P99", "MAX");
+  hist_t *hist = malloc(sizeof(hist_t));
+  for(int p = 0; phases[p].name != NULL; p++){
+    memset(hist, 0, sizeof(hist_t));
+    for(int i = 0; i < col->size; i++){
+      long long from = TIME_AT(&col->cmd[i]->times, phases[p].from);
+      long long to = TIME_AT(&col->cmd[i]->times, phases[p].to);
+      if(from != 0 && to != 0 && to >= from){
+        hist_record(hist, to - from);
+      }
+    }
+    if(hist->count == 0){
+      printf("%-12s %8d %8s %8s %8s\n", phases[p].name, 0, "-", "-", "-");
+      continue;
+    }
+    char p50[32], p99[32], max[32];
+    format_nanos(hist_percentile(hist, 50), p50, sizeof(p50));
+    format_nanos(hist_percentile(hist, 99), p99, sizeof(p99));
+    format_nanos(hist->max, max, sizeof(max));
+    printf("%-12s %8lld %8s %8s %8s\n", phases[p].name, hist->count, p50, p99, max);
+  }
+  free(hist);
+}
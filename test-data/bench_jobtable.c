@@ -0,0 +1,94 @@
+// Time the job table sweeps of commando with a large number of jobs
+//
+// usage: bench_jobtable [njobs [nrunning [reps]]]
+//
+// Fills a cmdcol_t with njobs jobs (default 100000) of which the last
+// nrunning (default 16) are real 'sleep' children and the rest are
+// marked finished as they would be late in a long session. Then times
+// the operations commando does at every prompt and for 'list':
+//
+//   update    cmdcol_update_state() sweep without blocking
+//   schedule  cmdcol_schedule() looking for jobs to start
+//   fullscan  cmd_update_state() on every job, the sweep before the
+//             live list, for comparison
+//   list      cmdcol_print() with output going to /dev/null
+//
+// and reports microseconds per call and nanoseconds per job.
+
+#include "../commando.h"
+
+static FILE *report;
+
+static void report_time(char *what, long long nanos, int reps, int njobs){
+  double per_call = (double) nanos / reps;
+  fprintf(report, "%-9s %8d jobs %10.1f us/call %8.2f ns/job\n",
+          what, njobs, per_call / 1000.0, per_call / njobs);
+}
+
+int main(int argc, char *argv[]){
+  int njobs    = (argc > 1) ? atoi(argv[1]) : 100000;
+  int nrunning = (argc > 2) ? atoi(argv[2]) : 16;
+  int reps     = (argc > 3) ? atoi(argv[3]) : 100;
+  if(njobs < 1 || nrunning < 0 || nrunning > njobs || reps < 1){
+    printf("usage: %s [njobs [nrunning [reps]]]\n", argv[0]);
+    return 1;
+  }
+
+  report = fdopen(dup(STDOUT_FILENO), "w");
+  freopen("/dev/null", "w", stdout); // job alerts and list output are not of interest
+
+  cmdcol_t col_actual = {};
+  cmdcol_t *col = &col_actual;
+  char *finished_argv[] = {"gcc", "-Wall", "-g", "-c", "cmdcol.c", NULL};
+  char *running_argv[] = {"sleep", "30", NULL};
+  for(int i = 0; i < njobs; i++){
+    int running = (i >= njobs - nrunning);
+    cmd_t *cmd = cmd_new(running ? running_argv : finished_argv);
+    cmdcol_add(col, cmd);
+    if(running){
+      cmd_start(cmd);
+    }
+    else{
+      cmd->pid = 100000 + i; // looks like a job which ran and exited
+      cmd->finished = 1;
+      cmd->status = 0;
+      snprintf(cmd->str_status, STATUS_LEN+1, "EXIT(0)");
+    }
+  }
+
+  long long start = now_nanos();
+  for(int r = 0; r < reps; r++){
+    cmdcol_schedule(col);
+  }
+  report_time("schedule", now_nanos() - start, reps, njobs);
+
+  start = now_nanos();
+  for(int r = 0; r < reps; r++){
+    cmdcol_update_state(col, NOBLOCK);
+  }
+  report_time("update", now_nanos() - start, reps, njobs);
+
+  start = now_nanos();
+  for(int r = 0; r < reps; r++){
+    for(int i = 0; i < col->size; i++){
+      cmd_update_state(col->cmd[i], NOBLOCK);
+    }
+  }
+  report_time("fullscan", now_nanos() - start, reps, njobs);
+
+  int list_reps = (reps + 9) / 10; // printing is much slower than the sweeps
+  start = now_nanos();
+  for(int r = 0; r < list_reps; r++){
+    cmdcol_print(col);
+    fflush(stdout);
+  }
+  report_time("list", now_nanos() - start, list_reps, njobs);
+
+  for(int i = njobs - nrunning; i < njobs; i++){
+    kill(col->cmd[i]->pid, SIGKILL);
+    cmd_update_state(col->cmd[i], DOBLOCK);
+  }
+  cmdcol_freeall(col);
+  fclose(report);
+  return 0;
+}
@@ -0,0 +1,14 @@
+#!/bin/bash
+# Reports how many fds are held by the process writing to the standard
+# input of this job, the feeder started by feed, then reads the input.
+# A feeder holding anything but its pipe keeps pipes of commando open.
+
+pipe=$(readlink /proc/$$/fd/0)
+for fd in /proc/[0-9]*/fd/*; do
+  pid=${fd#/proc/}
+  pid=${pid%%/*}
+  if [[ "$pid" != "$$" && "$(readlink "$fd" 2>/dev/null)" == "$pipe" ]]; then
+    echo "feeder fds $(ls /proc/$pid/fd | wc -l)"
+  fi
+done
+wc -l
@@ -0,0 +1,70 @@
+// Generate a given amount of output for stress testing commando
+//
+// usage: gen_output bytes [burst [pause_usecs]]
+//
+// Writes exactly bytes bytes of numbered 64-byte lines to standard
+// output, the last line possibly cut short. Output goes out in writes
+// of burst bytes (default 64K) with a pause of pause_usecs
+// microseconds (default 0) between them to produce bursty
+// output. Sizes take a K, M or G suffix such as 512M.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+long long parse_size(char *str){
+  char *end;
+  long long size = strtoll(str, &end, 10);
+  switch(*end){
+    case 'G': size *= 1024; // fall through
+    case 'M': size *= 1024; // fall through
+    case 'K': size *= 1024;
+  }
+  return size;
+}
+
+int main(int argc, char *argv[]){
+  if(argc < 2){
+    printf("usage: %s bytes [burst [pause_usecs]]\n", argv[0]);
+    return 1;
+  }
+  long long total = parse_size(argv[1]);
+  long long burst = (argc > 2) ? parse_size(argv[2]) : 64*1024;
+  long pause_usecs = (argc > 3) ? atol(argv[3]) : 0;
+  if(burst <= 0){
+    burst = 64*1024;
+  }
+
+  // fill a buffer of whole lines once, the line numbers don't matter
+  // past the start of each line
+  char *buf = malloc(burst + 64);
+  long long fill = 0;
+  for(long long line = 0; fill < burst; line++){
+    fill += sprintf(buf + fill, "%015lld %047d\n", line, 0);
+  }
+
+  struct timespec tm = {
+    .tv_sec  = pause_usecs / 1000000,
+    .tv_nsec = (pause_usecs % 1000000) * 1000,
+  };
+  long long written = 0;
+  while(written < total){
+    long long n = (total - written < burst) ? total - written : burst;
+    long long off = 0;
+    while(off < n){
+      ssize_t w = write(STDOUT_FILENO, buf + off, n - off);
+      if(w <= 0){
+        return 2; // reader went away
+      }
+      off += w;
+    }
+    written += n;
+    if(pause_usecs > 0 && written < total){
+      nanosleep(&tm, NULL);
+    }
+  }
+  free(buf);
+  return 0;
+}
@@ -0,0 +1,20 @@
+#!/bin/bash
+# Reports resources held by the parent process, commando when run as a
+# job: its open file descriptors, its other children and those which
+# are zombies. This job itself is a running child and shows up as one
+# extra open pipe.
+
+echo "fds $(ls /proc/$PPID/fd | wc -l)"
+zombies=0
+children=0
+for stat in /proc/[0-9]*/stat; do
+  read -r pid comm state ppid rest < "$stat" 2>/dev/null || continue
+  if [[ "$ppid" == "$PPID" && "$pid" != "$$" ]]; then
+    children=$((children+1))
+    if [[ "$state" == "Z" ]]; then
+      zombies=$((zombies+1))
+    fi
+  fi
+done
+echo "children $children"
+echo "zombies $zombies"
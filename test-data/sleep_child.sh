@@ -0,0 +1,7 @@
+#!/bin/bash
+# Prints once it has had time to be watched, then sleeps in a child so
+# the job is more than one process.
+sleep 0.2
+echo started
+sleep 30
+echo done
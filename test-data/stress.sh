@@ -0,0 +1,184 @@
+#!/bin/bash
+# usage: stress.sh churn|huge|memfd|bursty|wide|fdlimit
+#
+# Drives ./commando through one stress scenario and prints a summary
+# which does not depend on timing so it can be checked by
+# test_stress.org. Hangs are caught by the testy timeout. Throughput
+# for each run is appended to test-results/stress.log. Set
+# STRESS_JOBS or STRESS_BYTES to scale the scenarios up.
+
+JOBS=${STRESS_JOBS:-10000}
+BYTES=${STRESS_BYTES:-256M}
+LOG=test-results/stress.log
+out=$(mktemp)
+trap 'rm -f "$out"' EXIT
+mkdir -p test-results
+
+# run commando on the lines from standard input, timing it; not in a
+# pipeline so elapsed_ms is set in this shell
+function run_commando(){
+  local start=$(date +%s%N)
+  ./commando "$@" > "$out"
+  local status=$?
+  elapsed_ms=$(( ($(date +%s%N) - start) / 1000000 ))
+  echo "commando exit status: $status"
+}
+
+function log(){
+  echo "$(date '+%F %T') $1: $2 in ${elapsed_ms}ms" >> $LOG
+}
+
+# fds and zombies reported by the proc_check.sh jobs, first and last
+function check_resources(){
+  local fds=($(grep '^fds ' "$out" | cut -d' ' -f2))
+  local zombies=($(grep '^zombies ' "$out" | cut -d' ' -f2))
+  # the exec pipe of the checking job may or may not be closed yet
+  if (( ${fds[-1]} <= ${fds[0]} + 1 )); then
+    echo "leaked fds: none"
+  else
+    echo "leaked fds: $(( ${fds[-1]} - ${fds[0]} ))"
+  fi
+  echo "zombies: ${zombies[-1]}"
+}
+
+case "$1" in
+  churn)                        # many short jobs started and reaped rapidly
+    run_commando --max-jobs 64 < <(
+      echo test-data/proc_check.sh
+      echo wait-all
+      for((i=0; i<JOBS; i++)); do
+        echo true
+      done
+      echo wait-all
+      echo test-data/proc_check.sh
+      echo wait-all
+      echo output-for 0
+      echo "output-for $((JOBS+1))"
+      echo exit
+    )
+    echo "jobs exited 0: $(grep -c 'EXIT(0)$' "$out")"
+    check_resources
+    log churn "$JOBS jobs ($(( JOBS * 1000 / (elapsed_ms + 1) )) jobs/s)"
+    ;;
+
+  huge)                         # outputs far larger than a pipe
+    run_commando --output-budget 64M < <(
+      echo test-data/proc_check.sh
+      echo wait-all
+      echo "test-data/gen_output $BYTES"
+      echo "test-data/gen_output $BYTES 1M"
+      echo wait-all
+      echo "feed 1 wc -c"
+      echo "feed 2 wc -c"
+      echo wait-all
+      echo test-data/proc_check.sh
+      echo wait-all
+      echo list
+      echo output-for 0
+      echo output-for 3
+      echo output-for 4
+      echo output-for 5
+      echo exit
+    )
+    echo "jobs exited 0: $(grep -c 'EXIT(0)$' "$out")"
+    echo "output sizes: $(grep 'gen_output' "$out" | grep -v '^@' | awk '{print $5, $6}' | sort | uniq -c)"
+    echo "wc -c of outputs: $(grep -A2 'Output for wc' "$out" | grep -v '^[@-]' | sort | uniq -c)"
+    check_resources
+    log huge "2 x $BYTES"
+    ;;
+
+  memfd)                        # GB-scale outputs captured through memfds
+    MEMFD_BYTES=${STRESS_MEMFD_BYTES:-1G}
+    run_commando --capture memfd < <(
+      echo test-data/proc_check.sh
+      echo wait-all
+      echo "test-data/gen_output $MEMFD_BYTES"
+      echo wait-all
+      echo "feed 1 wc -c"
+      echo wait-all
+      echo test-data/proc_check.sh
+      echo wait-all
+      echo list
+      echo output-for 0
+      echo output-for 2
+      echo output-for 3
+      echo exit
+    )
+    echo "jobs exited 0: $(grep -c 'EXIT(0)$' "$out")"
+    echo "output size: $(grep 'gen_output' "$out" | grep -v '^@' | awk '{print $5}')"
+    echo "wc -c of output: $(grep -A2 'Output for wc' "$out" | grep -v '^[@-]')"
+    check_resources
+    log memfd "$MEMFD_BYTES"
+    ;;
+
+  bursty)                       # many jobs writing in small bursts at once
+    run_commando < <(
+      echo test-data/proc_check.sh
+      echo wait-all
+      for((i=0; i<200; i++)); do
+        echo test-data/gen_output 1M 4K 100
+      done
+      echo wait-all
+      echo test-data/proc_check.sh
+      echo wait-all
+      echo list
+      echo output-for 0
+      echo output-for 201
+      echo exit
+    )
+    echo "jobs exited 0: $(grep -c 'EXIT(0)$' "$out")"
+    echo "output sizes: $(grep 'gen_output' "$out" | grep -v '^@' | awk '{print $5}' | sort | uniq -c)"
+    check_resources
+    log bursty "200 x 1M"
+    ;;
+
+  wide)                         # thousands of jobs running at the same time
+    WIDE=${STRESS_WIDE:-5000}
+    run_commando < <(
+      echo test-data/proc_check.sh
+      echo wait-all
+      for((i=0; i<WIDE; i++)); do
+        echo test-data/sleep_print 20 wide
+      done
+      echo test-data/proc_check.sh
+      echo wait-all
+      echo test-data/proc_check.sh
+      echo wait-all
+      echo output-for 0
+      echo "output-for $((WIDE+1))"
+      echo "output-for $((WIDE+2))"
+      echo exit
+    )
+    children=$(grep '^children ' "$out" | sed -n 2p | cut -d' ' -f2)
+    if (( children >= WIDE )); then
+      echo "concurrent jobs: all $WIDE"
+    else
+      echo "concurrent jobs: only $children of $WIDE"
+    fi
+    echo "jobs exited 20: $(grep -c 'EXIT(20)$' "$out")"
+    check_resources
+    log wide "$WIDE jobs"
+    ;;
+
+  fdlimit)                      # more jobs than fds, jobs must queue
+    ulimit -n 64                # lowers the hard limit too so commando cannot raise it
+    run_commando < <(
+      for((i=0; i<200; i++)); do
+        echo test-data/sleep_print 1 queued
+      done
+      echo wait-all
+      echo test-data/proc_check.sh
+      echo wait-all
+      echo output-for 200
+      echo exit
+    )
+    echo "jobs exited 1: $(grep -c 'EXIT(1)$' "$out")"
+    echo "zombies: $(grep '^zombies ' "$out" | cut -d' ' -f2)"
+    log fdlimit "200 jobs with 64 fds"
+    ;;
+
+  *)
+    echo "usage: $0 churn|huge|memfd|bursty|wide|fdlimit"
+    exit 1
+    ;;
+esac
@@ -1,5 +1,6 @@
 #include <string.h>
 #include "commando.h"
+#include "libcommando.h"
 #include <sys/stat.h>
 #include <fcntl.h>
 
@@ -40,6 +41,21 @@ void assert_pointers_unique(char *argv[], cmd_t *cmd){
 }
 
 
+// Completion callback for the libcommando tests, records each job
+// in the array passed as arg so they can be printed in job order.
+typedef struct { int status; char str_status[STATUS_LEN+1]; int size; char output[64]; } libjob_t;
+
+void libcommando_done(commando_t *mgr, int job, int status, const char *str_status, void *arg){
+  libjob_t *rec = &((libjob_t *) arg)[job];
+  rec->status = status;
+  snprintf(rec->str_status, sizeof(rec->str_status), "%s", str_status);
+  const char *buf;
+  if(commando_output(mgr, job, &buf, &rec->size) == COMMANDO_OK){
+    snprintf(rec->output, sizeof(rec->output), "%.20s", buf);
+  }
+}
+
+
 int main(int argc, char *argv[]){
   if(argc < 2){
     printf("usage: %s <test_name>\n", argv[0]);
@@ -295,6 +311,30 @@ int main(int argc, char *argv[]){
     cmd_free(cmd);
   } // ENDTEST
 
+  else if( strcmp( test_name, "cmd_update_4" )==0 ) {
+    PRINT_TEST;
+    // Tests that a cmd set to CAPTURE_MEMFD writes its
+    // output to a memfd rather than a pipe and that
+    // cmd_update() maps it in as the output once the
+    // cmd finishes. No pipe is ever created.
+    char *argv[] = {
+      "cat",
+      "test-data/quote.txt",
+      NULL
+    };
+    cmd_t *cmd = cmd_new(argv);
+    cmd->capture = CAPTURE_MEMFD;
+    cmd_start(cmd);                // start running
+    printf("cmd->capture_fd > 0: %s\n",
+           cmd->capture_fd > 0 ? "yes" : "no");
+    cmd_update_state(cmd,DOBLOCK); // wait for completion
+                                   // should see an alert
+    test_print_cmd(cmd);           // show completed cmd
+    printf("cmd->capture_fd: %d\n", cmd->capture_fd);
+    printf("cmd->output_mapped: %d\n", cmd->output_mapped);
+    cmd_free(cmd);
+  } // ENDTEST
+
   else if( strcmp( test_name, "cmd_print_output_1" )==0 ) {
     PRINT_TEST;
     // Tests whether cmd_print_output() correctly
@@ -383,6 +423,30 @@ int main(int argc, char *argv[]){
     }
     cmdcol_freeall(cmdcol);
   } // ENDTEST
+  else if( strcmp( test_name, "cmdcol_add_3" )==0 ) {
+    PRINT_TEST;
+    // Tests that cmdcol_add() grows the collection past
+    // its initial MAX_CMDS capacity and that
+    // cmdcol_freeall() frees the grown array.
+    char *argv[] = {"true",NULL};
+    int count = 3*MAX_CMDS + 7;
+    cmdcol_t cmdcol_actual = {};
+    cmdcol_t *cmdcol = &cmdcol_actual;
+    for(int i=0; i<count; i++){
+      cmd_t *cmd = cmd_new(argv);
+      cmdcol_add(cmdcol, cmd);
+    }
+    printf("cmdcol->size: %d\n",cmdcol->size);
+    printf("cmdcol->size == count: %s\n",
+           cmdcol->size == count ? "yes" : "no");
+    printf("cmdcol->cmd[0]->name: %s\n",
+           cmdcol->cmd[0]->name);
+    printf("cmdcol->cmd[count-1]->name: %s\n",
+           cmdcol->cmd[count-1]->name);
+    printf("cmdcol->cmd[count-1]->str_status: %s\n",
+           cmdcol->cmd[count-1]->str_status);
+    cmdcol_freeall(cmdcol);
+  } // ENDTEST
 
   else if( strcmp( test_name, "cmdcol_update_state_1" )==0 ) {
     PRINT_TEST;
@@ -489,6 +553,300 @@ int main(int argc, char *argv[]){
     cmdcol_freeall(cmdcol);
   } // ENDTEST
 
+  else if( strcmp( test_name, "path_lookup_1" )==0 ) {
+    PRINT_TEST;
+    // Tests that path_lookup() finds commands in PATH
+    // as absolute paths, caches them so the second
+    // lookup returns the same string, leaves names
+    // with a / alone and returns NULL for names not
+    // in PATH. Where seq lives varies so only the end
+    // of its path is shown.
+    char *seq = path_lookup("seq");
+    printf("seq found: %s\n", seq != NULL ? "yes" : "no");
+    printf("seq absolute: %s\n", seq[0] == '/' ? "yes" : "no");
+    printf("seq ends with: %s\n", strrchr(seq, '/'));
+    printf("seq cached: %s\n",
+           path_lookup("seq") == seq ? "yes" : "no");
+    printf("test-data/print_args: %s\n",
+           path_lookup("test-data/print_args"));
+    printf("no_such_command_here: %s\n",
+           path_lookup("no_such_command_here"));
+    path_cache_clear();
+  } // ENDTEST
+
+  else if( strcmp( test_name, "path_lookup_2" )==0 ) {
+    PRINT_TEST;
+    // Tests that an empty entry in PATH, leading, in the
+    // middle or trailing, means the current directory as
+    // it does for execvp(), so testy in the directory the
+    // tests run in is found there.
+    char *saved = strdup(getenv("PATH"));
+    char *paths[] = {":/nonexistent", "/nonexistent::/also/not", "/nonexistent:", NULL};
+    for(int i = 0; paths[i] != NULL; i++){
+      setenv("PATH", paths[i], 1);
+      printf("PATH=%s testy: %s\n", paths[i], path_lookup("testy"));
+      path_cache_clear();
+    }
+    setenv("PATH", "/nonexistent", 1);
+    printf("PATH=/nonexistent testy: %s\n", path_lookup("testy"));
+    setenv("PATH", saved, 1);
+    free(saved);
+  } // ENDTEST
+
+  else if( strcmp( test_name, "print_timed_output_1" )==0 ) {
+    PRINT_TEST;
+    // Tests that cmd_print_timed_output() stamps each
+    // line with when its first byte arrived and marks
+    // long waits before output and before the end of
+    // output. The output and its arrival times are
+    // filled in by hand so the times are exact: a
+    // 30s stall lands in the middle of the third line
+    // and the job is quiet for 30.88s before exiting.
+    char *argv[] = {"make", "all", NULL};
+    cmd_t *cmd = cmd_new(argv);
+    char *out = "compiling\nlinking\nwaiting...done\nbye";
+    cmd->output = strdup(out);
+    cmd->output_size = strlen(out);
+    cmd->times.fork = 1000000000LL;
+    cmd->times.output_eof = 62000000000LL;
+    outchunk_t chunks[] = {
+      { 1002000000LL,  0},      // compiling
+      { 1010000000LL, 10},      // linking
+      {31118000000LL, 28},      // done
+      {31120000000LL, 33},      // bye
+    };
+    cmd->chunks = malloc(sizeof(chunks));
+    memcpy(cmd->chunks, chunks, sizeof(chunks));
+    cmd->nchunks = 4;
+    cmd->chunks_max = 4;
+    cmd_print_timed_output(cmd, 1, 0);
+    cmd_print_timed_output(cmd, 0, 1000000000LL);
+    cmd_print_timed_output(cmd, 1, 1000000000LL);
+    cmd_free(cmd);
+  } // ENDTEST
+
+  else if( strcmp( test_name, "on_output_1" )==0 ) {
+    PRINT_TEST;
+    // Tests the on-output matcher with the overlapping
+    // patterns he, she, his and hers fed in pieces
+    // which split the matches: "ush" then "ers" holds
+    // she, he and hers. Each trigger fires only once
+    // and a fired run trigger leaves a job for
+    // cmdcol_run_triggers() to add.
+    char *argv[] = {"cat", "notes.txt", NULL};
+    char *run_argv[] = {"echo", "found", "his", NULL};
+    cmd_t *cmd = cmd_new(argv);
+    cmd_add_trigger(cmd, "he", TRIGGER_ALERT, NULL);
+    cmd_add_trigger(cmd, "she", TRIGGER_ALERT, NULL);
+    cmd_add_trigger(cmd, "his", TRIGGER_RUN, run_argv);
+    cmd_add_trigger(cmd, "hers", TRIGGER_ALERT, NULL);
+    printf("empty pattern: %d\n", cmd_add_trigger(cmd, "", TRIGGER_ALERT, NULL));
+    char *pieces[] = {"ush", "ers", " ushers", " h", "is", NULL};
+    for(int i = 0; pieces[i] != NULL; i++){
+      printf("scan '%s'\n", pieces[i]);
+      cmd_scan_output(cmd, pieces[i], strlen(pieces[i]));
+    }
+    printf("watching: %d\n", cmd_watching(cmd));
+    cmd->finished = 1;          // never started, keeps it from being scheduled
+    cmdcol_t cmdcol_actual = {};
+    cmdcol_t *cmdcol = &cmdcol_actual;
+    cmdcol_add(cmdcol, cmd);
+    cmdcol_update_state(cmdcol, NOBLOCK); // adds the job and starts it
+    cmdcol_print(cmdcol);
+    cmdcol_wait_for(cmdcol, cmdcol->cmd[1]);
+    cmd_print_output(cmdcol->cmd[1]);
+    cmdcol_freeall(cmdcol);
+  } // ENDTEST
+
+  else if( strcmp( test_name, "segmented_output_1" )==0 ) {
+    PRINT_TEST;
+    // Tests that output longer than one segment stays
+    // in the segs chain once fetched while short output
+    // is compacted into cmd->output. The chain is
+    // written out with cmd_write_output() and read back
+    // with read_all() to check nothing was lost, then
+    // joined into one buffer with cmd_join_output().
+    char *small_argv[] = {"seq", "3", NULL};
+    cmd_t *small = cmd_new(small_argv);
+    cmd_start(small);
+    cmd_update_state(small, DOBLOCK);
+    printf("small output in segments: %s\n", (small->segs != NULL) ? "yes" : "no");
+    test_print_cmd(small);
+    cmd_free(small);
+
+    char *argv[] = {"seq", "10000", NULL};
+    cmd_t *cmd = cmd_new(argv);
+    cmd_start(cmd);
+    cmd_update_state(cmd, DOBLOCK);
+    printf("output_size: %d\n", cmd->output_size);
+    printf("output in one buffer: %s\n", (cmd->output != NULL) ? "yes" : "no");
+    printf("in memory: %d\n", cmd_output_in_memory(cmd));
+    for(outseg_t *seg = cmd->segs; seg != NULL; seg = seg->next){
+      printf("segment of %d bytes\n", seg->len);
+    }
+    char *expect = malloc(cmd->output_size + 1);
+    int len = 0;
+    for(int i = 1; i <= 10000; i++){
+      len += sprintf(expect + len, "%d\n", i);
+    }
+    FILE *tmp = tmpfile();
+    printf("cmd_write_output(): %d\n", cmd_write_output(cmd, fileno(tmp), 0));
+    lseek(fileno(tmp), 0, SEEK_SET);
+    int nread;
+    char *written = read_all(fileno(tmp), &nread);
+    fclose(tmp);
+    printf("written: %d bytes, same as seq: %s\n", nread,
+           (nread == len && memcmp(written, expect, len) == 0) ? "yes" : "no");
+    char *joined = cmd_join_output(cmd);
+    printf("joined: %s, segments left: %s, same as seq: %s\n",
+           (joined == cmd->output) ? "cmd->output" : "elsewhere",
+           (cmd->segs != NULL) ? "yes" : "no",
+           (strlen(joined) == len && strcmp(joined, expect) == 0) ? "yes" : "no");
+    free(written);
+    free(expect);
+    cmd_free(cmd);
+  } // ENDTEST
+
+  else if( strcmp( test_name, "bench_report_1" )==0 ) {
+    PRINT_TEST;
+    // Tests the summary printed by bench on runs filled
+    // in by hand so the numbers are exact: 5 runs of
+    // 1 to 5ms wall time give a mean of 3ms, sample
+    // standard deviation 1.581 and interpolated p90 of
+    // 4.6ms. The second report has a run whose output
+    // and status differ from the others.
+    benchrun_t runs[5];
+    for(int i = 0; i < 5; i++){
+      runs[i] = (benchrun_t) {
+        .wall = (i+1) * 1000000LL, .user = 500000LL, .sys = i * 250000LL,
+        .maxrss = 2048 + 1024*(i%2), .hash = 0xfeedfaceULL, .nbytes = 12, .wstatus = 0,
+      };
+    }
+    bench_report(runs, 5);
+    runs[3].hash = 0xdeadbeefULL;
+    runs[4].wstatus = 1 << 8; // EXIT(1)
+    bench_report(runs, 5);
+    bench_report(runs, 1); // a single run has no spread
+  } // ENDTEST
+
+  else if( strcmp( test_name, "libcommando_1" )==0 ) {
+    PRINT_TEST;
+    // Tests the library interface: 5 jobs with at most 2
+    // running at once are driven by polling commando_fd()
+    // until none are pending. Callbacks come in the order
+    // jobs finish so they are recorded and printed in job
+    // order. Also checks the error codes for bad calls.
+    int err;
+    commando_t *mgr = commando_open(2, &err);
+    printf("open: %s\n", commando_strerror(err));
+    char *argvs[][4] = {
+      {"seq", "5000", NULL},
+      {"echo", "hello", "world", NULL},
+      {"test-data/no_such_program", NULL},
+      {"false", NULL},
+      {"seq", "3", NULL},
+    };
+    libjob_t recs[5];
+    memset(recs, 0, sizeof(recs));
+    for(int i = 0; i < 5; i++){
+      printf("add: job %d\n", commando_add(mgr, argvs[i], libcommando_done, recs));
+    }
+    char *empty[] = {NULL};
+    printf("add empty: %s\n", commando_strerror(commando_add(mgr, empty, NULL, NULL)));
+    while(commando_pending(mgr) > 0){
+      struct pollfd pfd = { .fd = commando_fd(mgr), .events = POLLIN };
+      poll(&pfd, 1, 1000);
+      commando_process_events(mgr);
+    }
+    for(int i = 0; i < 5; i++){
+      printf("job %d: status %d %-10s %5d bytes: ", i, recs[i].status, recs[i].str_status, recs[i].size);
+      for(char *c = recs[i].output; *c != '\0'; c++){
+        putchar(*c == '\n' ? ' ' : *c);
+      }
+      printf("\n");
+    }
+    const char *buf;
+    int size;
+    printf("release 0: %s\n", commando_strerror(commando_release(mgr, 0)));
+    printf("output 0: %s\n", commando_strerror(commando_output(mgr, 0, &buf, &size)));
+    printf("output 9: %s\n", commando_strerror(commando_output(mgr, 9, &buf, &size)));
+    printf("signal 1: %s\n", commando_strerror(commando_signal(mgr, 1, SIGTERM)));
+    commando_close(mgr);
+  } // ENDTEST
+
+  else if( strcmp( test_name, "libcommando_2" )==0 ) {
+    PRINT_TEST;
+    // A job which leaves a child in the background holding
+    // its output open is reaped before its output ends. The
+    // host must not block on it meanwhile: no call takes long,
+    // and the callback comes once the output is complete.
+    int err;
+    commando_t *mgr = commando_open(0, &err);
+    char *argv[] = {"sh", "-c", "echo start; (sleep 0.5; echo late) & echo end", NULL};
+    libjob_t recs[2];
+    memset(recs, 0, sizeof(recs));
+    printf("add: job %d\n", commando_add(mgr, argv, libcommando_done, recs));
+    long long slowest = 0;
+    while(commando_pending(mgr) > 0){
+      struct pollfd pfd = { .fd = commando_fd(mgr), .events = POLLIN };
+      poll(&pfd, 1, 1000);
+      long long start = now_nanos();
+      commando_process_events(mgr);
+      if(now_nanos() - start > slowest){
+        slowest = now_nanos() - start;
+      }
+    }
+    printf("process_events under 100ms: %s\n", (slowest < 100000000) ? "yes" : "no");
+    printf("job 0: status %d %s %d bytes\n%s", recs[0].status, recs[0].str_status, recs[0].size, recs[0].output);
+    char *linger[] = {"sh", "-c", "sleep 2 & exit 3", NULL};
+    commando_add(mgr, linger, libcommando_done, recs);
+    long long start = now_nanos();
+    commando_close(mgr); // frees the job still holding its pipe
+    printf("close under 1s: %s\n", (now_nanos() - start < 1000000000) ? "yes" : "no");
+  } // ENDTEST
+
+  else if( strcmp( test_name, "libcommando_3" )==0 ) {
+    PRINT_TEST;
+    // Closing the manager kills the process group of a job
+    // still running, so a child it started goes with it
+    // rather than being left behind.
+    int err;
+    commando_t *mgr = commando_open(0, &err);
+    char *argv[] = {"sh", "-c", "sleep 30 & echo $! > test-results/libcommando_3.pid; wait", NULL};
+    libjob_t recs[1];
+    memset(recs, 0, sizeof(recs));
+    printf("add: job %d\n", commando_add(mgr, argv, libcommando_done, recs));
+    int child = 0;
+    for(int tries = 0; child == 0 && tries < 100; tries++){
+      usleep(10000);
+      FILE *pidfile = fopen("test-results/libcommando_3.pid", "r");
+      if(pidfile != NULL){
+        if(fscanf(pidfile, "%d", &child) != 1){
+          child = 0;
+        }
+        fclose(pidfile);
+      }
+    }
+    printf("child started: %s\n", (child > 0) ? "yes" : "no");
+    commando_close(mgr);
+    int gone = 0;
+    for(int tries = 0; !gone && tries < 100; tries++){
+      char path[64], state = 'Z';
+      snprintf(path, sizeof(path), "/proc/%d/stat", child);
+      FILE *procstat = fopen(path, "r");
+      if(procstat != NULL && fscanf(procstat, "%*d (%*[^)]) %c", &state) != 1){
+        state = '?';
+      }
+      if(procstat != NULL){
+        fclose(procstat);
+      }
+      gone = (state == 'Z'); // dead, if not yet reaped by init
+      usleep(10000);
+    }
+    printf("child killed: %s\n", gone ? "yes" : "no");
+    unlink("test-results/libcommando_3.pid");
+  } // ENDTEST
+
   else{
     printf("No test named '%s' found\n",test_name);
     return 1;
@@ -0,0 +1,124 @@
+// trace.c: export of the job timeline as a Chrome trace-event file
+
+#include "commando.h"
+
+// counter_step_t: change to a session-wide counter at a point in time
+typedef struct {
+  long long time;          // CLOCK_MONOTONIC nanoseconds
+  int running;             // change in the number of running jobs
+  long long output;        // change in bytes of output captured
+} counter_step_t;
+
+static int compare_steps(const void *a, const void *b)
+{
+  long long ta = ((counter_step_t *) a)->time, tb = ((counter_step_t *) b)->time;
+  return (ta > tb) - (ta < tb);
+}
+
+static void print_json_string(FILE *out, char *str)
+// Prints str as a quoted JSON string, escaping as needed.
+{
+  fputc('"', out);
+  for(; *str != '\0'; str++){
+    if(*str == '"' || *str == '\\'){
+      fprintf(out, "\\%c", *str);
+    }
+    else if((unsigned char) *str < 0x20){
+      fprintf(out, "\\u%04x", *str);
+    }
+    else{
+      fputc(*str, out);
+    }
+  }
+  fputc('"', out);
+}
+
+static void print_span(FILE *out, char *name, int tid, long long base, long long from, long long to)
+// Prints a complete ("X") event if both ends of the span are known.
+{
+  if(from == 0 || to == 0 || to < from){
+    return;
+  }
+  fprintf(out, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+          name, tid, (from - base) / 1e3, (to - from) / 1e3);
+}
+
+int cmdcol_write_trace(cmdcol_t *col, char *path)
+/* Writes the timeline of all jobs in col to path in the Chrome
+  trace-event JSON format which chrome://tracing and Perfetto can
+  open. Each job gets its own track showing its queued, running and
+  exited (finished but not yet reaped) spans along with an instant
+  event for its final status. Counter tracks show the number of
+  running jobs and the total output captured over the session. Times
+  are in microseconds from the creation of the first job. Returns 0 on
+  success and -1 if path could not be written.
+*/
+{
+  FILE *out = fopen(path, "we"); // close-on-exec like all of commando's fds
+  if(out == NULL){
+    perror(path);
+    return -1;
+  }
+  long long base = 0;
+  for(int i = 0; i < col->size; i++){
+    long long created = col->cmd[i]->times.created;
+    if(base == 0 || created < base){
+      base = created;
+    }
+  }
+
+  fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"commando\"}}");
+  counter_step_t *steps = malloc((2*col->size + 1) * sizeof(counter_step_t));
+  int nsteps = 0;
+  for(int i = 0; i < col->size; i++){
+    cmd_t *cmd = col->cmd[i];
+    cmdtimes_t *t = &cmd->times;
+    int tid = i+1;              // track 0 is left for commando itself
+
+    char label[MAX_LINE];
+    int len = snprintf(label, sizeof(label), "job %d:", i);
+    for(int j = 0; cmd->argv[j] != NULL && len < (int) sizeof(label); j++){
+      len += snprintf(label+len, sizeof(label)-len, " %s", cmd->argv[j]);
+    }
+    fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":", tid);
+    print_json_string(out, label);
+    fprintf(out, "}},\n{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"sort_index\":%d}}", tid, tid);
+
+    long long end_running = (t->output_eof != 0) ? t->output_eof : t->reaped;
+    print_span(out, "queued", tid, base, t->created, (t->fork != 0) ? t->fork : t->reaped);
+    print_span(out, "running", tid, base, t->fork, end_running);
+    print_span(out, "exited", tid, base, end_running, t->reaped);
+    if(t->reaped != 0){
+      fprintf(out, ",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%d,\"ts\":%.3f}",
+              cmd->str_status, tid, (t->reaped - base) / 1e3);
+    }
+
+    if(t->fork != 0){
+      steps[nsteps++] = (counter_step_t) { .time = t->fork, .running = 1 };
+    }
+    if(t->reaped != 0){
+      steps[nsteps++] = (counter_step_t) { .time = t->reaped, .running = -1,
+                                           .output = (cmd->output_size > 0) ? cmd->output_size : 0 };
+    }
+  }
+
+  qsort(steps, nsteps, sizeof(counter_step_t), compare_steps);
+  int running = 0;
+  long long output = 0;
+  for(int i = 0; i < nsteps; i++){
+    running += steps[i].running;
+    output += steps[i].output;
+    fprintf(out, ",\n{\"name\":\"running jobs\",\"ph\":\"C\",\"pid\":1,\"ts\":%.3f,\"args\":{\"jobs\":%d}}",
+            (steps[i].time - base) / 1e3, running);
+    fprintf(out, ",\n{\"name\":\"output captured\",\"ph\":\"C\",\"pid\":1,\"ts\":%.3f,\"args\":{\"bytes\":%lld}}",
+            (steps[i].time - base) / 1e3, output);
+  }
+  free(steps);
+  fprintf(out, "\n]}\n");
+  if(fclose(out) != 0){
+    perror(path);
+    return -1;
+  }
+  return 0;
+}
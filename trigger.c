@@ -0,0 +1,216 @@
+// trigger.c: on-output patterns matched against job output as it is drained
+
+#include "commando.h"
+
+// All the patterns watched for in the output of a job are compiled
+// into one Aho-Corasick automaton with the failure links folded into
+// a full transition table, so scanning costs one table lookup and one
+// test per byte however many patterns there are. The state is kept
+// between reads so a pattern split across two reads still matches.
+// Each trigger owns a bit in a 64-bit mask, hits[s] holds the bits of
+// every pattern ending at state s, and fired holds the bits of those
+// already seen: each trigger fires once.
+
+static trigger_t **pending = NULL; // fired TRIGGER_RUN triggers whose jobs are not added yet
+static int npending = 0;
+static int pending_max = 0;
+
+static void pending_clear(void)
+// Forgets fired triggers whose jobs were never added, at exit.
+{
+  free(pending);
+  pending = NULL;
+  npending = pending_max = 0;
+}
+
+static void matcher_build(matcher_t *m)
+/* (Re)builds the automaton for the current triggers of m. The trie is
+  built with 0 meaning no edge as no edge leads back to the root, then
+  a breadth first pass fills in the missing edges from the failure
+  links and adds the matches of each failure state to its own.
+*/
+{
+  int max_states = 1;
+  for(int i = 0; i < m->ntriggers; i++){
+    max_states += strlen(m->triggers[i].pattern);
+  }
+  free(m->next);
+  free(m->hits);
+  m->next = calloc(max_states, sizeof(*m->next));
+  m->hits = calloc(max_states, sizeof(*m->hits));
+  m->nstates = 1;
+
+  for(int i = 0; i < m->ntriggers; i++){ // trie of the patterns
+    int s = 0;
+    for(unsigned char *c = (unsigned char *) m->triggers[i].pattern; *c != '\0'; c++){
+      if(m->next[s][*c] == 0){
+        m->next[s][*c] = m->nstates++;
+      }
+      s = m->next[s][*c];
+    }
+    m->hits[s] |= 1ULL << i;
+  }
+
+  int *fail = calloc(m->nstates, sizeof(int));
+  int *queue = malloc(m->nstates * sizeof(int));
+  int head = 0, tail = 0;
+  for(int c = 0; c < 256; c++){
+    if(m->next[0][c] != 0){
+      queue[tail++] = m->next[0][c]; // depth 1 states fail to the root
+    }
+  }
+  while(head < tail){
+    int s = queue[head++];
+    m->hits[s] |= m->hits[fail[s]]; // a pattern ending at a suffix ends here too
+    for(int c = 0; c < 256; c++){
+      int child = m->next[s][c];
+      if(child != 0){
+        fail[child] = m->next[fail[s]][c]; // fail[s] is shallower so already complete
+        queue[tail++] = child;
+      }
+      else{
+        m->next[s][c] = m->next[fail[s]][c];
+      }
+    }
+  }
+  free(fail);
+  free(queue);
+  m->state = 0; // partial matches of the old patterns are lost
+}
+
+int cmd_add_trigger(cmd_t *cmd, char *pattern, int action, char *argv[])
+/* Adds a trigger to cmd which fires the first time pattern shows up
+  in output drained from the job after this call. action is one of
+  TRIGGER_ALERT, TRIGGER_KILL, or TRIGGER_RUN in which case argv[] is
+  the command to run as a new job. Returns 0 on success and -1 if the
+  pattern is empty, argv[] is missing for TRIGGER_RUN, or cmd already
+  has MAX_TRIGGERS triggers.
+*/
+{
+  if(pattern[0] == '\0' || (action == TRIGGER_RUN && (argv == NULL || argv[0] == NULL))){
+    return -1;
+  }
+  if(cmd->matcher == NULL){
+    cmd->matcher = calloc(1, sizeof(matcher_t));
+  }
+  matcher_t *m = cmd->matcher;
+  if(m->ntriggers == MAX_TRIGGERS){
+    return -1;
+  }
+  trigger_t *t = &m->triggers[m->ntriggers++];
+  t->pattern = strdup(pattern);
+  t->action = action;
+  t->argv = NULL;
+  if(action == TRIGGER_RUN){
+    int argc = 0;
+    while(argv[argc] != NULL){
+      argc++;
+    }
+    t->argv = malloc((argc+1) * sizeof(char *));
+    for(int i = 0; i < argc; i++){
+      t->argv[i] = strdup(argv[i]);
+    }
+    t->argv[argc] = NULL;
+  }
+  matcher_build(m);
+  return 0;
+}
+
+static void fire(cmd_t *cmd, trigger_t *t)
+// Carries out the action of a trigger whose pattern was just seen.
+{
+  char what[MAX_LINE];
+  snprintf(what, sizeof(what), "on-output '%s' seen", t->pattern);
+  cmd_alert(cmd, what);
+  fflush(stdout); // may be waiting for input at the prompt
+  if(t->action == TRIGGER_KILL && cmd->pid > 0){
+    if(kill(-cmd->pid, SIGTERM) == -1){ // no group if the child has not got to setpgid()
+      kill(cmd->pid, SIGTERM);
+    }
+  }
+  else if(t->action == TRIGGER_RUN){ // needs the cmdcol, see cmdcol_run_triggers()
+    if(pending_max == 0){
+      atexit(pending_clear); // a trigger may fire during the last update before exit
+    }
+    if(npending == pending_max){
+      pending_max = (pending_max == 0) ? 8 : 2*pending_max;
+      pending = realloc(pending, pending_max * sizeof(trigger_t *));
+    }
+    pending[npending++] = t;
+  }
+}
+
+void cmd_scan_output(cmd_t *cmd, char *buf, int len)
+/* Runs the len bytes of newly drained output in buf through the
+  automaton of cmd, firing the triggers whose patterns end in them.
+  Does nothing if cmd has no triggers.
+*/
+{
+  matcher_t *m = cmd->matcher;
+  if(m == NULL){
+    return;
+  }
+  int s = m->state;
+  for(int i = 0; i < len; i++){
+    s = m->next[s][(unsigned char) buf[i]];
+    unsigned long long hits = m->hits[s] & ~m->fired;
+    if(hits != 0){
+      m->fired |= hits;
+      for(int b = 0; b < m->ntriggers; b++){
+        if(hits & (1ULL << b)){
+          fire(cmd, &m->triggers[b]);
+        }
+      }
+    }
+  }
+  m->state = s;
+}
+
+int cmd_watching(cmd_t *cmd)
+// Returns 1 if cmd has triggers which have not fired yet.
+{
+  matcher_t *m = cmd->matcher;
+  return m != NULL && m->fired != ((m->ntriggers == MAX_TRIGGERS) ? ~0ULL : (1ULL << m->ntriggers) - 1);
+}
+
+void matcher_free(matcher_t *m)
+// Frees m and its triggers, which may be NULL.
+{
+  if(m == NULL){
+    return;
+  }
+  for(int i = 0; i < m->ntriggers; i++){
+    free(m->triggers[i].pattern);
+    for(int j = 0; m->triggers[i].argv != NULL && m->triggers[i].argv[j] != NULL; j++){
+      free(m->triggers[i].argv[j]);
+    }
+    free(m->triggers[i].argv);
+  }
+  free(m->next);
+  free(m->hits);
+  free(m);
+}
+
+int cmdcol_run_triggers(cmdcol_t *col)
+/* Adds a job to col for each TRIGGER_RUN trigger which has fired
+  since the last call and starts it if it can. Scanning happens deep
+  in cmd_drain() where the cmdcol is not at hand, so the jobs are
+  added here instead, called from every cmdcol_update_state(). Returns
+  the number of jobs added.
+*/
+{
+  int nadded = 0;
+  for(int i = 0; i < npending; i++){
+    cmd_t *cmd = cmd_new(pending[i]->argv);
+    if(cmdcol_add(col, cmd) == -1){
+      cmd_free(cmd); // out of memory, the trigger has still fired
+      continue;
+    }
+    nadded++;
+  }
+  if(npending > 0){
+    npending = 0;
+    cmdcol_schedule(col);
+  }
+  return nadded;
+}
@@ -5,14 +5,27 @@
 void parse_into_tokens(char input_command[], char *tokens[], int *ntok)
 // Parse the contents of input_command so that tokens[i] will point to
 // the ith space-separated string in it. Set ntok to the number of
-// tokens that are found.
+// tokens that are found. A string starting with ~ or holding *, ? or
+// [ is replaced by the paths it expands to, see glob.c; those tokens
+// last until the next call. If a pattern expands past ARG_MAX tokens
+// an error is printed and no tokens are returned.
 {
+  glob_release(); // expansions made for the last line
   int i = 0;
   char *tok = strtok(input_command," \n"); // Splits input_command str into tokens according to given delimiters.
 
   while(tok!=NULL && i<ARG_MAX){ // ARG_MAX is 255
-    tokens[i] = tok;  // assign tokens to found string
-    i++;
+    int nglob = glob_token(tok, tokens + i, ARG_MAX - i);
+    if(nglob == -1){
+      printf("%s: expands to more than %d arguments\n", tok, ARG_MAX);
+      i = 0;
+      break;
+    }
+    if(nglob == 0){
+      tokens[i] = tok;  // assign tokens to found string
+      nglob = 1;
+    }
+    i += nglob;
     tok = strtok(NULL," \n");
   }
   tokens[i] = NULL; // null terminate tokens to ease argv[] work
@@ -20,6 +33,88 @@ void parse_into_tokens(char input_command[], char *tokens[], int *ntok)
   return;
 }
 
+// Look for a '< file' redirection among tokens. If found, remove
+// both tokens, shift later tokens down, update ntok, and return the
+// file name which still points into the original input. Returns NULL
+// if there is no redirection.
+char *parse_stdin_redirect(char *tokens[], int *ntok)
+{
+  for(int i=0; i<*ntok; i++){
+    if(strcmp(tokens[i], "<") == 0 && i+1 < *ntok){
+      char *file = tokens[i+1];
+      for(int j=i; j+2<=*ntok; j++){ // shift down including the NULL
+        tokens[j] = tokens[j+2];
+      }
+      *ntok -= 2;
+      return file;
+    }
+  }
+  return NULL;
+}
+
+// Buffer of input read from standard input but not yet returned
+// by read_line(). Reading raw chunks rather than through stdio lets
+// commando tell whether a whole line is waiting via line_ready().
+static char inbuf[MAX_LINE];
+static int inlen = 0;
+static int ineof = 0;
+
+// Returns 1 if read_line() can return a line without reading more
+// input.
+int line_ready(void)
+{
+  return memchr(inbuf, '\n', inlen) != NULL || inlen == MAX_LINE || (ineof && inlen > 0);
+}
+
+// Copies input read from standard input but not yet returned by
+// read_line() into buf, which has room for MAX_LINE bytes, so reexec
+// can hand it on to the new commando. Returns the number of bytes.
+int input_save(char *buf)
+{
+  memcpy(buf, inbuf, inlen);
+  return inlen;
+}
+
+// Puts back len bytes saved by input_save() in another commando to be
+// returned by read_line() before anything more is read.
+void input_restore(char *buf, int len)
+{
+  memcpy(inbuf, buf, len);
+  inlen = len;
+}
+
+// Read one line from standard input into buf like fgets(): at most
+// size-1 characters including the newline are stored followed by
+// '\0'. Returns buf or NULL at the end of input.
+char *read_line(char *buf, int size)
+{
+  while(!line_ready() && !ineof){
+    int nread = read(STDIN_FILENO, inbuf+inlen, MAX_LINE-inlen);
+    if(nread == -1 && errno == EINTR){
+      continue;
+    }
+    if(nread <= 0){
+      ineof = 1;
+    }
+    else{
+      inlen += nread;
+    }
+  }
+  if(inlen == 0){
+    return NULL;
+  }
+  char *newline = memchr(inbuf, '\n', inlen);
+  int len = (newline != NULL) ? newline - inbuf + 1 : inlen;
+  if(len > size-1){
+    len = size-1;
+  }
+  memcpy(buf, inbuf, len);
+  buf[len] = '\0';
+  memmove(inbuf, inbuf+len, inlen-len);
+  inlen -= len;
+  return buf;
+}
+
 // Sleep the running program for the given number of nanoseconds and
 // seconds.
 void pause_for(long nanos, int secs){
@@ -27,5 +122,47 @@ void pause_for(long nanos, int secs){
     .tv_nsec = nanos,
     .tv_sec  = secs,
   };
-  nanosleep(&tm,NULL);
+  while(nanosleep(&tm,&tm) == -1 && errno == EINTR); // keep sleeping if a child exits
+}
+
+// Parses a size such as 4096, 64K, 512M or 2G into a number of
+// bytes. Suffixes are powers of 1024. Returns -1 if str is not a size.
+long long parse_size(char *str){
+  char *end;
+  long long size = strtoll(str, &end, 10);
+  if(end == str || size < 0){
+    return -1;
+  }
+  switch(*end){
+    case 'G': case 'g': size *= 1024; // fall through
+    case 'M': case 'm': size *= 1024; // fall through
+    case 'K': case 'k': size *= 1024; end++; break;
+    case '\0': break;
+    default: return -1;
+  }
+  return (*end == '\0') ? size : -1;
+}
+
+// Parses a signal given as a number such as 9 or a name such as KILL
+// or SIGKILL. Returns -1 if str is not a signal.
+int parse_signal(char *str){
+  static struct { char *name; int sig; } signals[] = {
+    {"HUP", SIGHUP}, {"INT", SIGINT}, {"QUIT", SIGQUIT}, {"KILL", SIGKILL},
+    {"USR1", SIGUSR1}, {"USR2", SIGUSR2}, {"ALRM", SIGALRM}, {"TERM", SIGTERM},
+    {"CONT", SIGCONT}, {"STOP", SIGSTOP}, {"TSTP", SIGTSTP},
+  };
+  char *end;
+  long sig = strtol(str, &end, 10);
+  if(end != str && *end == '\0'){
+    return (sig > 0 && sig < NSIG) ? sig : -1;
+  }
+  if(strncmp(str, "SIG", 3) == 0){
+    str += 3;
+  }
+  for(int i = 0; i < (int) (sizeof(signals) / sizeof(signals[0])); i++){
+    if(strcmp(str, signals[i].name) == 0){
+      return signals[i].sig;
+    }
+  }
+  return -1;
 }